@@ -128,6 +128,7 @@ SOURCES += \
         src/scripts.cpp \
         src/search.cpp \
         src/searchthread.cpp \
+        src/seedstream.cpp \
         src/tabbiomes.cpp \
         src/tablocations.cpp \
         src/tabstructures.cpp \
@@ -135,6 +136,7 @@ SOURCES += \
         src/main.cpp \
         src/util.cpp \
         src/widgets.cpp \
+        src/workerpolicy.cpp \
         src/world.cpp
 
 HEADERS += \
@@ -193,6 +195,7 @@ HEADERS += \
         src/scripts.h \
         src/search.h \
         src/searchthread.h \
+        src/seedstream.h \
         src/seedtables.h \
         src/tabbiomes.h \
         src/tablocations.h \
@@ -200,6 +203,7 @@ HEADERS += \
         src/mainwindow.h \
         src/util.h \
         src/widgets.h \
+        src/workerpolicy.h \
         src/world.h
 
 FORMS += \
@@ -240,9 +244,9 @@ TRANSLATIONS += \
 # enable network features with: qmake CONFIG+=with_network
 with_network: {
     QT += network
-    DEFINES += "WITH_UPDATER=1"
-    SOURCES += src/updater.cpp
-    HEADERS += src/updater.h
+    DEFINES += "WITH_UPDATER=1" "WITH_DISTRIBUTED=1"
+    SOURCES += src/updater.cpp src/searchserver.cpp
+    HEADERS += src/updater.h src/searchserver.h
 }
 
 # enable dbus features with: qmake CONFIG+=with_dbus
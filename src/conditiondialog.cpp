@@ -1460,6 +1460,8 @@ void ConditionDialog::on_comboLua_currentIndexChanged(int)
     ui->textEditLuaOut->document()->setPlainText("");
     ui->textEditLua->document()->setPlainText("");
     ui->textEditLua->document()->setModified(false);
+    ui->textEditLua->setLineSamples(std::map<int, uint64_t>());
+    ui->textEditLua->setToolTip("");
     luahash = 0;
     uint64_t hash = ui->comboLua->currentData().toULongLong();
     QMap<uint64_t, QString> scripts;
@@ -1485,8 +1487,17 @@ void ConditionDialog::on_comboLua_currentIndexChanged(int)
         ui->tabWidgetLua->tabBar()->setTabTextColor(
                 ui->tabWidgetLua->indexOf(ui->tabLuaOutput), QColor(255,0,0));
     }
+    locker.unlock();
     ui->textEditLua->document()->setPlainText(text);
     ui->textEditLua->document()->setModified(false);
+    LuaProfileOutput& lp = g_lua_profile[cond.save];
+    QMutexLocker plocker(&lp.mutex);
+    if (lp.hash == hash && lp.prof.calls)
+    {
+        ui->textEditLua->setLineSamples(lp.prof.lines);
+        ui->textEditLua->setToolTip(tr("Profile of the last search:\n%1")
+            .arg(formatLuaProfile(lp.prof, 5)));
+    }
     luahash = hash;
 }
 
@@ -1524,6 +1535,7 @@ void ConditionDialog::onLuaSaveAs(const QString& fileName)
     stream << ui->textEditLua->document()->toPlainText();
     stream.flush();
     file.close();
+    invalidateScripts();
     ui->textEditLua->document()->setModified(false);
     uint64_t hash = getScriptHash(QFileInfo(fnam));
     ui->comboLua->addItem(QFileInfo(fnam).baseName(), QVariant::fromValue(hash));
@@ -1549,6 +1561,8 @@ void ConditionDialog::on_pushLuaExample_clicked()
     QStringList examples = {
         tr("Empty check functions"),
         tr("Village along the way from A to B"),
+        tr("Batched check of many seeds"),
+        tr("Map overlay of the ocean share"),
     };
     QMap<QString, QString> code = {
         {   examples[0],
@@ -1586,6 +1600,54 @@ void ConditionDialog::on_pushLuaExample_clicked()
             "\treturn nil\n"
             "end"
         },
+        {   examples[2],
+            "-- check_batch() is optionally used by the search to test many\n"
+            "-- seeds at once, when the condition has no relative location.\n"
+            "function check_batch(seeds, positions)\n"
+            "\tlocal results = {}\n"
+            "\tfor i = 1, #seeds do\n"
+            "\t\tsetSeed(seeds[i])\n"
+            "\t\tlocal at = positions[i]\n"
+            "\t\tresults[i] = getBiomeAt(at.x, at.z) == plains\n"
+            "\tend\n"
+            "\treturn results\n"
+            "end\n\n"
+            "-- check() is still used outside of the search.\n"
+            "function check(seed, at, deps)\n"
+            "\tif getBiomeAt(at.x, at.z) ~= plains then return nil end\n"
+            "\treturn at.x, at.z\n"
+            "end"
+        },
+        {   examples[3],
+            "-- tile() is evaluated by the map for the \"Lua overlay\" in\n"
+            "-- the context menu. It gets the area of a map tile at the given\n"
+            "-- scale and returns a list of w*h values in row-major order,\n"
+            "-- optionally followed by the range for the colors.\n"
+            "local oceans = {\n"
+            "\t[ocean] = true, [deep_ocean] = true, [frozen_ocean] = true,\n"
+            "\t[warm_ocean] = true, [lukewarm_ocean] = true, [cold_ocean] = true,\n"
+            "\t[deep_lukewarm_ocean] = true, [deep_cold_ocean] = true,\n"
+            "\t[deep_frozen_ocean] = true,\n"
+            "}\n\n"
+            "function tile(seed, x, z, w, h, scale)\n"
+            "\t-- sample the biomes with 16x16 cells per value\n"
+            "\tlocal s = math.max(4, scale // 16)\n"
+            "\tlocal f = scale // s\n"
+            "\tlocal b = getBiomeArea(s, x*f, z*f, w*f, h*f)\n"
+            "\tif b == nil then return nil end\n"
+            "\tlocal v = {}\n"
+            "\tfor j = 0, h-1 do\n"
+            "\t\tfor i = 0, w-1 do\n"
+            "\t\t\tlocal n = 0\n"
+            "\t\t\tfor k = 0, f*f-1 do\n"
+            "\t\t\t\tif oceans[b(i*f + k%f, j*f + k//f)] then n = n + 1 end\n"
+            "\t\t\tend\n"
+            "\t\t\tv[j*w + i + 1] = n / (f*f)\n"
+            "\t\tend\n"
+            "\tend\n"
+            "\treturn v, 0, 1\n"
+            "end"
+        },
     };
 
     QInputDialog *dialog = new QInputDialog(this);
@@ -1641,6 +1703,40 @@ void ConditionDialog::on_pushInfoLua_clicked()
         "function, with a similar prototype, that tests whether a given "
         "48-bit seed base is worth investigating further."
         "</p><p>"
+        "A script can describe itself to the search with a global "
+        "<b>meta</b> table, such as "
+        "<b>meta = { dep64 = false, reach = 2048, cost = \"high\" }</b>, "
+        "which is read when the script is loaded. With <b>dep64 = false</b> "
+        "the script promises that <b>check()</b> only depends on the lower "
+        "48 bits of the seed, so it can also reject 48-bit seed bases and "
+        "its results are reused for seeds with the same base, while "
+        "<b>dep64 = true</b> limits 48-bit tests to <b>check48()</b>. "
+        "A <b>reach</b> bounds the distance in blocks from the location at "
+        "which the script queries structures and returns positions, and the "
+        "<b>cost</b> (\"low\", \"medium\" or \"high\") decides whether the "
+        "condition is tested before or after the built-in filters next to it."
+        "</p><p>"
+        "For conditions at the top level (without a relative location), the "
+        "search can also use an optional <b>check_batch(seeds, positions)</b> "
+        "function to test many seeds in a single call. Its arguments are "
+        "lists of the queued seeds and the matching <b>{x, z, deps}</b> "
+        "entries, and it should return a list with a true value for each "
+        "seed that passes. Use <b>setSeed(seed)</b> within this function to "
+        "select the seed for the world queries. The <b>check()</b> function "
+        "is still required for the other tools."
+        "</p><p>"
+        "The argument tables are reused between calls, so their contents "
+        "should be copied if they are needed later."
+        "</p><p>"
+        "Scripts can also visualize the world in the map view, through the "
+        "<b>Lua overlay</b> entry of its context menu. Such a script defines "
+        "a <b>tile(seed, x, z, w, h, scale)</b> function that returns a list "
+        "(or area) of <b>w*h</b> values for a map tile with the given scale, "
+        "optionally followed by the <b>min, max</b> range for the heatmap "
+        "(0 to 1 by default). Values that are not numbers are transparent. "
+        "The tiles are evaluated by the map worker threads and are cached "
+        "like the biome tiles."
+        "</p><p>"
         "A few global symbols are predefined. These include the biome ID "
         "and structure type enums from cubiomes, which means they can be "
         "referred to by their names (such as <b>flower_forest</b> or "
@@ -1649,10 +1745,31 @@ void ConditionDialog::on_pushInfoLua_clicked()
         "<dl><dt><b>getBiomeAt(x, z)</b><dt><b>getBiomeAt(x, y, z)</b>"
         "<dd>returns the overworld biome at the given block coordinates"
         "</p><p>"
-        "<dt><b>getStructures(type, x1, z1, x2, z2)</b>"
+        "<dt><b>getStructures(type, x1, z1, x2, z2 [, limit])</b>"
         "<dd>returns a list of <b>{x, z}</b> structure positions for the "
         "specified structure <b>type</b> within the area spanning the block "
-        "positions <b>x1, z1</b> to <b>x2, z2</b>, or <b>nil</b> upon failure"
+        "positions <b>x1, z1</b> to <b>x2, z2</b>, or <b>nil</b> upon failure; "
+        "the search ends early once <b>limit</b> instances are found"
+        "</p><p>"
+        "<dt><b>getBiomeArea(scale, x, z, w, h [, y])</b>"
+        "<dd>generates the overworld biomes of an area, with <b>x, z, w, h</b> "
+        "at the given <b>scale</b> (1, 4, 16, 64 or 256)"
+        "</p><p>"
+        "<dt><b>getClimateArea(para, x, z, w, h)</b>"
+        "<dd>samples a climate parameter over an area at scale 1:4 (1.18+), "
+        "where <b>para</b> is 0: temperature, 1: humidity, 2: continentalness, "
+        "3: erosion or 5: weirdness"
+        "</p><p>"
+        "<dt><b>getHeightArea(x, z, w, h)</b>"
+        "<dd>approximates the surface height over an area at scale 1:4 (1.18+)"
+        "</p><p>"
+        "The area functions return a buffer <b>a</b> with fields <b>x, z, w, h, "
+        "scale</b>, that is indexed as <b>a[j*w + i + 1]</b> or <b>a(i, j)</b>, "
+        "or <b>nil</b> upon failure."
+        "</p><p>"
+        "<dt><b>setSeed(seed)</b>"
+        "<dd>switches the world queries to a different seed (only within "
+        "<b>check_batch()</b>)"
         "</p></body></html>"
         ));
     mb->show();
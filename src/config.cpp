@@ -17,6 +17,9 @@ ExtGenConfig g_extgen;
 
 qreal g_fontscale = 1;
 qreal g_iconscale = 1;
+int g_luabudget = 0;
+bool g_luaprofiling = false;
+bool g_condstats = false;
 
 
 void ExtGenConfig::reset()
@@ -372,6 +375,8 @@ void Config::reset()
     fontMono.setPointSize(10);
     fontNorm.setPointSize(10);
     iconScale = 1.0;
+    luaBudget = 0;
+    luaProfile = false;
 }
 
 void Config::load(QSettings& settings)
@@ -395,6 +400,8 @@ void Config::load(QSettings& settings)
     fontNorm = settings.value("config/fontNorm", fontNorm).value<QFont>();
     fontMono = settings.value("config/fontMono", fontMono).value<QFont>();
     iconScale = settings.value("config/iconScale", iconScale).toDouble();
+    luaBudget = settings.value("config/luaBudget", luaBudget).toInt();
+    luaProfile = settings.value("config/luaProfile", luaProfile).toBool();
 }
 
 void Config::save(QSettings& settings)
@@ -418,6 +425,8 @@ void Config::save(QSettings& settings)
     settings.setValue("config/fontNorm", fontNorm);
     settings.setValue("config/fontMono", fontMono);
     settings.setValue("config/iconScale", iconScale);
+    settings.setValue("config/luaBudget", luaBudget);
+    settings.setValue("config/luaProfile", luaProfile);
 }
 
 void Gen48Config::reset()
@@ -492,7 +501,7 @@ uint64_t Gen48Config::estimateSeedCnt(uint64_t slist48len)
             if (qmonumentQual(*s) >= qmarea)
                 cnt++;
     }
-    else if (mode == GEN48_LIST)
+    else if (mode == GEN48_LIST || mode == GEN48_SOLVE)
     {
         cnt = slist48len;
     }
@@ -501,7 +510,7 @@ uint64_t Gen48Config::estimateSeedCnt(uint64_t slist48len)
         cnt = MASK48 + 1;
     }
 
-    if (mode != GEN48_NONE)
+    if (mode != GEN48_NONE && mode != GEN48_SOLVE)
     {
         uint64_t w = x2 - x1 + 1;
         uint64_t h = z2 - z1 + 1;
@@ -523,6 +532,9 @@ void SearchConfig::reset()
     stoponres = true;
     smin = 0;
     smax = ~(uint64_t)0;
+    listorder = LIST_ORDER_FILE;
+    shardidx = 0;
+    shardcnt = 1;
 }
 
 bool SearchConfig::read(const QString& line)
@@ -537,6 +549,8 @@ bool SearchConfig::read(const QString& line)
     if (sscanf(p, "#ResStop:  %d", &tmp) == 1)              { stoponres = tmp; return true; }
     if (sscanf(p, "#SMin:     %" PRIu64, &smin) == 1)       return true;
     if (sscanf(p, "#SMax:     %" PRIu64, &smax) == 1)       return true;
+    if (sscanf(p, "#LOrder:   %d", &listorder) == 1)        return true;
+    if (sscanf(p, "#Shard:    %d/%d", &shardidx, &shardcnt) == 2) return true;
     return false;
 }
 
@@ -552,6 +566,42 @@ void SearchConfig::write(QTextStream& stream)
         stream << "#SMin:     " << smin << "\n";
     if (smax != ~(uint64_t)0)
         stream << "#SMax:     " << smax << "\n";
+    if (listorder != LIST_ORDER_FILE)
+        stream << "#LOrder:   " << listorder << "\n";
+    if (shardcnt > 1)
+        stream << "#Shard:    " << shardidx << "/" << shardcnt << "\n";
+    stream.flush();
+}
+
+void Checkpoint::reset()
+{
+    ranges.clear();
+    held.clear();
+    results = 0;
+    done = false;
+}
+
+bool Checkpoint::read(const QString& line)
+{
+    QByteArray ba = line.toLocal8Bit();
+    const char *p = ba.data();
+    uint64_t a, b;
+    if (sscanf(p, "#Completed: %" PRIu64 " %" PRIu64, &a, &b) == 2)  { ranges.emplace_back(a, b); return true; }
+    if (sscanf(p, "#Held:     %" PRIu64 " %" PRIu64, &a, &b) == 2)  { held.emplace_back(a, b); return true; }
+    if (sscanf(p, "#Results:  %" PRIu64, &results) == 1)            return true;
+    if (line.startsWith("#Done"))                                   { done = true; return true; }
+    return false;
+}
+
+void Checkpoint::write(QTextStream& stream)
+{
+    for (const auto& r : ranges)
+        stream << "#Completed: " << r.first << " " << r.second << "\n";
+    for (const auto& h : held)
+        stream << "#Held:     " << h.first << " " << h.second << "\n";
+    stream << "#Results:  " << results << "\n";
+    if (done)
+        stream << "#Done\n";
     stream.flush();
 }
 
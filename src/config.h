@@ -14,6 +14,7 @@
 #define APP_STRING "cubiomes-viewer"
 
 #define PRECOMPUTE48_BUFSIZ ((int64_t)1 << 30)
+#define TERRAIN_CACHE_BUFSIZ ((int64_t)1 << 25)
 
 
 struct ExtGenConfig
@@ -38,6 +39,13 @@ extern unsigned char g_tempsColors[256][3];
 extern qreal g_fontscale;
 extern qreal g_iconscale;
 
+// Instruction budget per call of a Lua check (0 = unlimited), and whether
+// searches sample the hot lines of Lua scripts.
+extern int g_luabudget;
+extern bool g_luaprofiling;
+// Whether searches count the tests of each condition (for the metrics).
+extern bool g_condstats;
+
 // Keep the extended generator settings in global scope.
 extern ExtGenConfig g_extgen;
 
@@ -188,6 +196,8 @@ struct Config
     QFont fontNorm;
     QFont fontMono;
     qreal iconScale;
+    int luaBudget;
+    bool luaProfile;
 
     Config() { reset(); }
 
@@ -198,7 +208,8 @@ struct Config
     void save() { QSettings s(APP_STRING, APP_STRING); save(s); }
 };
 
-enum { GEN48_AUTO, GEN48_QH, GEN48_QM, GEN48_LIST, GEN48_NONE };
+// (saved by value in sessions, so new modes are appended)
+enum { GEN48_AUTO, GEN48_QH, GEN48_QM, GEN48_LIST, GEN48_NONE, GEN48_SOLVE };
 enum { IDEAL, CLASSIC, NORMAL, BARELY, IDEAL_SALTED };
 
 struct Gen48Config
@@ -224,15 +235,25 @@ struct Gen48Config
 // search type options from combobox
 enum { SEARCH_INC = 0, SEARCH_BLOCKS = 1, SEARCH_LIST = 2, SEARCH_48ONLY = 3 };
 
+// processing order of 64-bit seed lists
+enum {
+    LIST_ORDER_FILE,            // as listed in the file
+    LIST_ORDER_GROUP48,         // grouped by the lower 48 bits
+    LIST_ORDER_GROUP48_REPORT,  // grouped, but results reported in file order
+};
+
 struct SearchConfig
 {
     int searchtype;
     QString slist64path;
-    int threads;
+    int threads;    // worker threads (0: tuned automatically)
     uint64_t startseed;
     bool stoponres;
     uint64_t smin;
     uint64_t smax;
+    int listorder;
+    int shardidx;   // shard of the search space (of shardcnt interleaved shards)
+    int shardcnt;
 
     SearchConfig() { reset(); }
 
@@ -241,6 +262,21 @@ struct SearchConfig
     void write(QTextStream& stream);
 };
 
+// Search progress past the start seed (#Progress) of a checkpoint
+struct Checkpoint
+{
+    std::vector<std::pair<uint64_t,uint64_t>> ranges; // completed progress [a,b)
+    std::vector<std::pair<uint64_t,uint64_t>> held; // held results (index, seed)
+    uint64_t results;   // number of reported results
+    bool done;          // the search is complete
+
+    Checkpoint() { reset(); }
+
+    void reset();
+    bool read(const QString& line);
+    void write(QTextStream& stream);
+};
+
 
 Q_DECLARE_METATYPE(int64_t)
 Q_DECLARE_METATYPE(uint64_t)
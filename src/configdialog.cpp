@@ -23,6 +23,7 @@ ConfigDialog::ConfigDialog(QWidget *parent, Config *config)
 #endif
 
     ui->lineMatching->setValidator(new QIntValidator(1, 99999999, ui->lineMatching));
+    ui->lineLuaBudget->setValidator(new QIntValidator(0, INT_MAX, ui->lineLuaBudget));
     ui->spinThreads->setRange(1, QThread::idealThreadCount());
     ui->lineIconScale->setValidator(new QDoubleValidator(1.0/8, 16.0, 3, ui->lineIconScale));
 
@@ -85,6 +86,8 @@ void ConfigDialog::initConfig(Config *config)
     ui->spinFontSizeNorm->setValue(config->fontNorm.pointSize());
     ui->spinFontSizeMono->setValue(config->fontMono.pointSize());
     ui->lineIconScale->setText(QString::number(config->iconScale));
+    ui->lineLuaBudget->setText(config->luaBudget ? QString::number(config->luaBudget) : "");
+    ui->checkLuaProfile->setChecked(config->luaProfile);
 }
 
 Config ConfigDialog::getConfig()
@@ -114,6 +117,8 @@ Config ConfigDialog::getConfig()
     conf.fontMono.setStyleHint(QFont::Monospace);
 
     conf.iconScale = ui->lineIconScale->text().toDouble();
+    conf.luaBudget = ui->lineLuaBudget->text().toInt();
+    conf.luaProfile = ui->checkLuaProfile->isChecked();
 
     if (!conf.maxMatching) conf.maxMatching = 65536;
 
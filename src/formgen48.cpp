@@ -4,6 +4,7 @@
 #include "mainwindow.h"
 #include "message.h"
 #include "search.h"
+#include "seedstream.h"
 #include "seedtables.h"
 #include "util.h"
 
@@ -99,14 +100,8 @@ bool FormGen48::setList48(QString path, bool quiet)
         slist48path = path;
         parent->prevdir = finfo.absolutePath();
 
-        uint64_t *l = NULL;
-        uint64_t len;
-        QByteArray ba = path.toLocal8Bit();
-        l = loadSavedSeeds(ba.data(), &len);
-        if (l != NULL)
+        if (loadSeedList(slist48, path))
         {
-            slist48.assign(l, l+len);
-            free(l);
             ok = true;
         }
         else if (!quiet)
@@ -168,7 +163,7 @@ bool FormGen48::setList48(QTextStream& stream)
 
 void FormGen48::setConfig(const Gen48Config& gen48, bool quiet)
 {
-    ui->tabWidget->setCurrentIndex(gen48.mode);
+    ui->tabWidget->setCurrentIndex(tabOfMode(gen48.mode));
     ui->comboLow20->setCurrentIndex(gen48.qual);
     spinMonumentArea->setValue(gen48.qmarea);
     ui->lineSalt->setText(QString::number(gen48.salt));
@@ -196,7 +191,7 @@ Gen48Config FormGen48::getConfig(bool resolveauto)
 {
     Gen48Config s;
 
-    s.mode = ui->tabWidget->currentIndex();
+    s.mode = currentMode();
     s.qual = ui->comboLow20->currentIndex();
     s.qmarea = spinMonumentArea->value();
     s.salt = ui->lineSalt->text().toLongLong();
@@ -216,16 +211,34 @@ Gen48Config FormGen48::getConfig(bool resolveauto)
             bool isqh = cond.type >= F_QH_IDEAL && cond.type <= F_QH_BARELY;
             bool isqm = cond.type >= F_QM_95 && cond.type <= F_QM_90;
             if (isqh) s.mode = GEN48_QH;
-            if (isqm) s.mode = GEN48_QM;
+            else if (isqm) s.mode = GEN48_QM;
         }
     }
 
     return s;
 }
 
+int FormGen48::getPins(std::vector<PinnedStruct>& pins)
+{
+    WorldInfo wi;
+    parent->getSeed(&wi, false);
+    return getPinnedStructs(pins, condlist, wi.mc);
+}
+
 uint64_t FormGen48::estimateSeedCnt()
 {
-    return getConfig(true).estimateSeedCnt(slist48.size());
+    Gen48Config gen48 = getConfig(true);
+    if (gen48.mode == GEN48_SOLVE)
+    {
+        std::vector<PinnedStruct> pins;
+        uint64_t cnt = MASK48 + 1;
+        if (getPins(pins) > 0)
+            cnt = estimatePinned48(pins);
+        if (cnt * sizeof(uint64_t) >= PRECOMPUTE48_BUFSIZ)
+            cnt = MASK48 + 1; // the solver will fall back to a full search
+        return gen48.estimateSeedCnt(cnt);
+    }
+    return gen48.estimateSeedCnt(slist48.size());
 }
 
 void FormGen48::updateCount()
@@ -246,6 +259,7 @@ void FormGen48::updateCount()
 
 void FormGen48::updateAutoConditions(const std::vector<Condition>& condlist)
 {
+    this->condlist = condlist;
     cond.type = 0;
     for (const Condition& c : condlist)
     {
@@ -264,18 +278,23 @@ void FormGen48::updateAutoUi()
     QString modestr = "";
     bool isqh = cond.type >= F_QH_IDEAL && cond.type <= F_QH_BARELY;
     bool isqm = cond.type >= F_QM_95 && cond.type <= F_QM_90;
+    std::vector<PinnedStruct> pins;
+    int pincnt = getPins(pins);
     if (isqh)
         modestr = tr("[Quad-hut]");
     else if (isqm)
         modestr = tr("[Quad-monument]");
+    else if (pincnt > 0)
+        modestr = tr("[Solver]");
     else
         modestr = tr("[None]");
 
     ui->labelAuto->setText(modestr);
+    ui->labelSolve->setText(tr("[%n pinned structure(s)]", "", pincnt));
 
     if (cond.type != 0)
     {
-        if (ui->tabWidget->currentIndex() == GEN48_AUTO)
+        if (currentMode() == GEN48_AUTO)
         {
             ui->radioAuto->setChecked(true);
 
@@ -286,7 +305,7 @@ void FormGen48::updateAutoUi()
         }
         if (ui->radioAuto->isChecked())
         {
-            if (ui->tabWidget->currentIndex() == GEN48_LIST)
+            if (currentMode() == GEN48_LIST)
             {
                 ui->lineEditX1->setText("0");
                 ui->lineEditZ1->setText("0");
@@ -338,16 +357,40 @@ void FormGen48::setAreaEnabled(bool enabled)
     ui->lineEditZ2->setEnabled(enabled);
 }
 
+int FormGen48::tabOfMode(int mode)
+{
+    QWidget *tab;
+    switch (mode)
+    {
+    case GEN48_QH:      tab = ui->tabQuadF; break;
+    case GEN48_QM:      tab = ui->tabQuadM; break;
+    case GEN48_LIST:    tab = ui->tabList; break;
+    case GEN48_SOLVE:   tab = ui->tabSolve; break;
+    default:            tab = ui->tabAuto; break; // (Auto/None)
+    }
+    return ui->tabWidget->indexOf(tab);
+}
+
+int FormGen48::currentMode()
+{
+    QWidget *tab = ui->tabWidget->currentWidget();
+    if (tab == ui->tabQuadF)    return GEN48_QH;
+    if (tab == ui->tabQuadM)    return GEN48_QM;
+    if (tab == ui->tabList)     return GEN48_LIST;
+    if (tab == ui->tabSolve)    return GEN48_SOLVE;
+    return GEN48_AUTO;
+}
+
 void FormGen48::updateMode()
 {
-    int mode = ui->tabWidget->currentIndex();
+    int mode = currentMode();
 
     //if (mode == GEN48_AUTO)
     {
         updateAutoUi();
     }
 
-    if (mode == GEN48_AUTO || mode == GEN48_NONE)
+    if (mode == GEN48_AUTO || mode == GEN48_SOLVE || mode == GEN48_NONE)
         setAreaEnabled(false);
     else
         setAreaEnabled(true);
@@ -40,8 +40,12 @@ signals:
 
 private:
     void setAreaEnabled(bool enabled);
+    int getPins(std::vector<PinnedStruct>& pins);
 
     void updateMode();
+    // the tab of a generator mode, and the mode of the current tab
+    int tabOfMode(int mode);
+    int currentMode();
 
 private slots:
     void on_tabWidget_currentChanged(int idx);
@@ -58,6 +62,8 @@ private:
 
     // main condition for "auto" mode (updated when conditions change)
     Condition cond;
+    // conditions that may pin structures for the 48-bit solver
+    std::vector<Condition> condlist;
 
     QString slist48path;
     std::vector<uint64_t> slist48;
@@ -5,9 +5,11 @@
 #include "message.h"
 #include "rangedialog.h"
 #include "search.h"
+#include "seedstream.h"
 #include "util.h"
 
 #include <QAction>
+#include <QActionGroup>
 #include <QClipboard>
 #include <QFileDialog>
 #include <QFontMetrics>
@@ -111,6 +113,8 @@ FormSearchControl::FormSearchControl(MainWindow *parent)
     , slist64path()
     , slist64fnam()
     , slist64()
+    , slist64map()
+    , listorder(LIST_ORDER_FILE)
     , smin(0)
     , smax(~(uint64_t)0)
     , qbuf()
@@ -192,6 +196,7 @@ SearchConfig FormSearchControl::getSearchConfig()
     s.stoponres = ui->checkStop->isChecked();
     s.smin = smin;
     s.smax = smax;
+    s.listorder = listorder;
     return s;
 }
 
@@ -212,6 +217,7 @@ bool FormSearchControl::setSearchConfig(SearchConfig s, bool quiet)
     ui->checkStop->setChecked(s.stoponres);
     smin = s.smin;
     smax = s.smax;
+    listorder = s.listorder;
 
 #if WASM
     (void) quiet;
@@ -239,18 +245,28 @@ bool FormSearchControl::setList64(QString path, bool quiet)
         parent->prevdir = finfo.absolutePath();
         slist64fnam = finfo.fileName();
         slist64path = path;
-        uint64_t *l = NULL;
-        uint64_t len;
-        QByteArray ba = path.toLocal8Bit();
-        l = loadSavedSeeds(ba.data(), &len);
-        if (l != NULL)
+        slist64map.reset();
+        std::vector<uint64_t> seeds;
+        if (SeedMap::isBinary(path))
+        {   // binary lists are searched in place rather than loaded
+            std::shared_ptr<SeedMap> map(new SeedMap);
+            QString err;
+            if (map->open(path, &err))
+            {
+                slist64.clear();
+                slist64map = map;
+                if (map->size())
+                    updateSearchProgress(0, map->size(), map->data()[0]);
+                return true;
+            }
+        }
+        else if (loadSeedList(seeds, path))
         {
-            slist64.assign(l, l+len);
-            updateSearchProgress(0, len, l[0]);
-            free(l);
+            slist64.swap(seeds);
+            updateSearchProgress(0, slist64.size(), slist64[0]);
             return true;
         }
-        else if (!quiet)
+        if (!quiet)
         {
             int button = warn(this, tr("Warning"),
                 tr("Failed to load 64-bit seed list from file:\n\"%1\"").arg(path),
@@ -260,6 +276,7 @@ bool FormSearchControl::setList64(QString path, bool quiet)
                 slist64fnam.clear();
                 slist64path.clear();
                 slist64.clear();
+                slist64map.reset();
             }
         }
     }
@@ -271,6 +288,7 @@ bool FormSearchControl::setList64(QTextStream& stream)
     slist64fnam.clear();
     slist64path.clear();
     slist64.clear();
+    slist64map.reset();
 
     while (!stream.atEnd())
     {
@@ -319,11 +337,12 @@ void FormSearchControl::setSearchMode(int mode)
     ui->comboSearchType->setCurrentIndex(ui->comboSearchType->findData(mode));
     if (mode == SEARCH_LIST)
     {
-        on_buttonMore_clicked();
+        openList64();
     }
     else
     {
         slist64.clear();
+        slist64map.reset();
         slist64path.clear();
         slist64fnam.clear();
     }
@@ -358,7 +377,7 @@ void FormSearchControl::on_buttonStart_clicked()
             warn(this, tr("Please define some constraints using the \"Add\" button."));
             ok = false;
         }
-        if (session.sc.searchtype == SEARCH_LIST && slist64.empty())
+        if (session.sc.searchtype == SEARCH_LIST && slist64.empty() && !slist64map)
         {
             warn(this, tr("No seed list file selected."));
             ok = false;
@@ -368,7 +387,10 @@ void FormSearchControl::on_buttonStart_clicked()
             session.gen48 = parent->formGen48->getConfig(true);
             // the search can either use a full list or a 48-bit list
             if (session.sc.searchtype == SEARCH_LIST)
+            {
                 session.slist = slist64;
+                session.slistmap = slist64map;
+            }
             else if (session.gen48.mode == GEN48_LIST)
                 session.slist = parent->formGen48->getList48();
             else
@@ -415,24 +437,50 @@ void FormSearchControl::on_buttonStart_clicked()
     update();
 }
 
+void FormSearchControl::openList64()
+{
+    QString filter = tr("Text files (*.txt);;Any files (*)");
+#if WASM
+    auto fileOpenCompleted = [=](const QString &fnam, const QByteArray &content) {
+        if (!fnam.isEmpty()) {
+            QTextStream stream(content);
+            setList64(stream);
+        }
+    };
+    QFileDialog::getOpenFileContent(filter, fileOpenCompleted);
+#else
+    QString fnam = QFileDialog::getOpenFileName(this, tr("Load seed list"), parent->prevdir, filter);
+    setList64(fnam, false);
+#endif
+}
+
 void FormSearchControl::on_buttonMore_clicked()
 {
     int type = ui->comboSearchType->currentData().toInt();
     if (type == SEARCH_LIST)
     {
-        QString filter = tr("Text files (*.txt);;Any files (*)");
-#if WASM
-        auto fileOpenCompleted = [=](const QString &fnam, const QByteArray &content) {
-            if (!fnam.isEmpty()) {
-                QTextStream stream(content);
-                setList64(stream);
-            }
+        QMenu *menu = new QMenu(this);
+        menu->setAttribute(Qt::WA_DeleteOnClose);
+        menu->addAction(tr("Load seed list..."), this, &FormSearchControl::openList64);
+        menu->addSection(tr("Processing order"));
+
+        // grouping seeds that share the lower 48 bits allows the search to
+        // reuse the 48-bit generator state between them
+        const char *orders[] = {
+            QT_TR_NOOP("As listed in file"),
+            QT_TR_NOOP("Grouped by lower 48 bits"),
+            QT_TR_NOOP("Grouped by lower 48 bits, report results in file order"),
         };
-        QFileDialog::getOpenFileContent(filter, fileOpenCompleted);
-#else
-        QString fnam = QFileDialog::getOpenFileName(this, tr("Load seed list"), parent->prevdir, filter);
-        setList64(fnam, false);
-#endif
+        QActionGroup *group = new QActionGroup(menu);
+        for (int i = LIST_ORDER_FILE; i <= LIST_ORDER_GROUP48_REPORT; i++)
+        {
+            QAction *act = menu->addAction(tr(orders[i]));
+            act->setCheckable(true);
+            act->setChecked(listorder == i);
+            act->setActionGroup(group);
+            connect(act, &QAction::triggered, this, [=]() { listorder = i; });
+        }
+        menu->popup(ui->buttonMore->mapToGlobal(QPoint(0, ui->buttonMore->height())));
     }
     else if (type == SEARCH_INC)
     {
@@ -516,7 +564,9 @@ void FormSearchControl::on_buttonSearchHelp_clicked()
         "existing set of seeds. The seeds should be in decimal ASCII text, "
         "separated by newline characters. You can browse for a file using "
         "the &quot;...&quot; button. (The seed generator is ignored with "
-        "this option.)"
+        "this option.) The same menu lets you group the list by the lower "
+        "48 bits, which allows seeds with the same 48-bit structure state "
+        "to share work."
         "</p></body></html>"
         ));
     mb->show();
@@ -705,7 +755,7 @@ void FormSearchControl::searchProgressReset()
         if (!slist64fnam.isEmpty())
         {
             fmt = slist64fnam + ": ";
-            cnt = slist64.size();
+            cnt = slist64map ? slist64map->size() : slist64.size();
         }
     }
     if (searchtype == SEARCH_INC)
@@ -125,6 +125,7 @@ public slots:
     void on_buttonClear_clicked();
     void on_buttonStart_clicked();
     void on_buttonMore_clicked();
+    void openList64();
 
     void onSort(int column, Qt::SortOrder);
     void onSeedSelectionChanged();
@@ -165,6 +166,8 @@ private:
     QString slist64path;
     QString slist64fnam; // file name without directory
     std::vector<uint64_t> slist64;
+    std::shared_ptr<const SeedMap> slist64map; // of a binary list (instead of slist64)
+    int listorder;
 
     // min and max seeds values
     uint64_t smin, smax;
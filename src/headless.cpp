@@ -1,12 +1,23 @@
 #include "headless.h"
 
 #include "message.h"
+#include "scripts.h"
+#include "seedstream.h"
 #include "util.h"
 
 #include <QApplication>
+#include <QCryptographicHash>
 #include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QSaveFile>
 #include <QStandardPaths>
 
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+
 #if defined(_WIN32)
 #include <windows.h>
 short get_term_width()
@@ -28,60 +39,405 @@ short get_term_width()
 #endif
 
 
+// the console text goes to stderr while the metrics take stdout
+static bool g_console_stderr = false;
+
 static QTextStream& qOut()
 {
     static QTextStream out (stdout);
-    return out;
+    static QTextStream err (stderr);
+    return g_console_stderr ? err : out;
+}
+
+// requests from signal handlers, which are polled by the event loop
+static volatile sig_atomic_t g_sigflush = 0;
+static volatile sig_atomic_t g_sigstop = 0;
+
+static void onSignal(int sig)
+{
+#ifdef SIGUSR1
+    if (sig == SIGUSR1)
+    {
+        g_sigflush = 1;
+        return;
+    }
+#endif
+    g_sigstop = 1;
+    signal(sig, SIG_DFL); // a repeated signal terminates immediately
+}
+
+static void putLE(char *p, uint64_t v, int n)
+{
+    for (int i = 0; i < n; i++)
+        p[i] = (char) (v >> (8*i));
+}
+
+static uint64_t getLE(const char *p, int n)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < n; i++)
+        v |= (uint64_t)(unsigned char) p[i] << (8*i);
+    return v;
+}
+
+// Is this a header line that defines the search, i.e. one that has to agree
+// between the outputs of the same search (such as the shards)?
+static bool isSearchLine(const QString& line)
+{
+    static const char *vary[] = {
+        "#Time:", "#Threads:", "#Progress:", "#Shard:", "#Done",
+        "#Completed:", "#Held:", "#Results:",
+    };
+    if (!line.startsWith("#"))
+        return false;
+    for (const char *v : vary)
+        if (line.startsWith(v))
+            return false;
+    return true;
+}
+
+static uint64_t sessionHash(const QStringList& header)
+{
+    QByteArray h = QCryptographicHash::hash(header.join("\n").toUtf8(), QCryptographicHash::Sha1);
+    return getLE(h.constData(), 8);
+}
+
+
+ResultWriter::ResultWriter()
+    : file()
+    , format(OUT_TEXT)
+    , tofile()
+    , buf()
+{
+}
+
+bool ResultWriter::open(const QString& path, int format, bool append)
+{
+    this->format = format;
+    if (!path.isEmpty())
+    {
+        file.setFileName(path);
+        QIODevice::OpenMode mode = QIODevice::ReadWrite;
+        if (!append)
+            mode |= QIODevice::Truncate;
+        if (file.open(mode))
+        {   // (an interrupted write may have left a partial record at the end)
+            qint64 end = completeSize();
+            if (end < file.size())
+                file.resize(end);
+            file.seek(end);
+            tofile = true;
+            return true;
+        }
+        if (format != OUT_TEXT)
+        {
+            warn(nullptr, "Output file for results could not be created.");
+            return false;
+        }
+        warn(nullptr, "Output file for results coult not be created - using stdout instead.");
+    }
+    else if (format != OUT_TEXT)
+    {   // (the binary data would be mixed with the console text)
+        return false;
+    }
+    file.open(stdout, QIODevice::WriteOnly);
+    return true;
+}
+
+// Gets the end of the last complete record of the output: the last whole
+// seed of the binary format, the last whole frame of the compressed format
+// or the last line break of the text format.
+qint64 ResultWriter::completeSize()
+{
+    qint64 size = file.size();
+    if (format == OUT_BINARY)
+        return size < 32 ? 0 : size - (size - 32) % 8;
+    if (format == OUT_COMPRESSED)
+    {
+        if (size < 8)
+            return 0;
+        qint64 pos = 8;
+        char n[4];
+        while (pos + 4 <= size && file.seek(pos) && file.read(n, 4) == 4)
+        {
+            qint64 len = (qint64) getLE(n, 4);
+            if (len <= 0 || len > size - pos - 4)
+                break;
+            pos += 4 + len;
+        }
+        return pos;
+    }
+    char buf[4096];
+    for (qint64 pos = size; pos > 0; )
+    {
+        qint64 n = pos < (qint64) sizeof(buf) ? pos : (qint64) sizeof(buf);
+        if (!file.seek(pos - n) || file.read(buf, n) != n)
+            return size;
+        for (qint64 i = n; i > 0; i--)
+            if (buf[i-1] == '\n')
+                return pos - n + i;
+        pos -= n;
+    }
+    return 0;
+}
+
+void ResultWriter::writeHeader(Session& session)
+{
+    QByteArray hdr;
+    QTextStream stream(&hdr, QIODevice::WriteOnly);
+    session.writeHeader(stream);
+
+    if (format == OUT_BINARY)
+    {
+        QStringList lines;
+        for (const QString& line : QString::fromLocal8Bit(hdr).split('\n'))
+            if (isSearchLine(line.trimmed()))
+                lines.append(line.trimmed());
+        char h[32] = "CVSEEDS";
+        putLE(h+8, sessionHash(lines), 8);
+        putLE(h+16, session.sc.shardidx, 4);
+        putLE(h+20, session.sc.shardcnt, 4);
+        buf.append(h, sizeof(h));
+    }
+    else
+    {
+        if (format == OUT_COMPRESSED)
+            file.write("CVSEEDZ", 8);
+        buf += hdr;
+    }
+    flush();
+}
+
+void ResultWriter::add(uint64_t seed)
+{
+    if (format == OUT_BINARY)
+    {
+        char b[8];
+        putLE(b, seed, 8);
+        buf.append(b, 8);
+    }
+    else
+    {
+        buf += QByteArray::number((qlonglong) seed);
+        buf += '\n';
+    }
+    if (buf.size() >= RESULTS_BUFSIZ)
+        flush();
+}
+
+void ResultWriter::flush()
+{
+    if (!buf.isEmpty())
+    {
+        if (format == OUT_COMPRESSED)
+        {
+            QByteArray z = qCompress(buf);
+            char n[4];
+            putLE(n, z.size(), 4);
+            file.write(n, 4);
+            file.write(z);
+        }
+        else
+        {
+            file.write(buf);
+        }
+        buf.clear();
+    }
+    file.flush();
+}
+
+void ResultWriter::finish(bool done)
+{
+    if (done && format != OUT_BINARY)
+        buf += "#Done\n";
+    flush();
+    if (done && format == OUT_BINARY && !file.isSequential())
+    {   // mark the completion in the header
+        qint64 end = file.pos();
+        char f[4];
+        putLE(f, RESULTS_DONE, 4);
+        if (file.seek(24))
+            file.write(f, 4);
+        file.seek(end);
+        file.flush();
+    }
+}
+
+bool ResultFile::read(const QString& path, QString *err)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        *err = QString("Failed to open: \"%1\"").arg(path);
+        return false;
+    }
+    QByteArray data = file.readAll();
+    QByteArray text;
+
+    if (data.startsWith(QByteArray("CVSEEDS", 8)))
+    {
+        format = OUT_BINARY;
+        if (data.size() < 32)
+        {
+            *err = QString("Binary results are truncated: \"%1\"").arg(path);
+            return false;
+        }
+        const char *p = data.constData();
+        hash = getLE(p+8, 8);
+        shardidx = (int32_t) getLE(p+16, 4);
+        shardcnt = (int32_t) getLE(p+20, 4);
+        done = getLE(p+24, 4) & RESULTS_DONE;
+        if (shardcnt < 1)
+        {
+            *err = QString("Binary results have an invalid header: \"%1\"").arg(path);
+            return false;
+        }
+        // (an interrupted write may have left a partial seed at the end)
+        size_t n = (data.size() - 32) / 8;
+        seeds.reserve(n);
+        for (size_t i = 0; i < n; i++)
+            seeds.push_back(getLE(p + 32 + 8*i, 8));
+        return true;
+    }
+
+    if (data.startsWith(QByteArray("CVSEEDZ", 8)))
+    {
+        format = OUT_COMPRESSED;
+        int pos = 8;
+        while (pos + 4 <= data.size())
+        {
+            int n = (int) getLE(data.constData() + pos, 4);
+            if (n <= 0 || n > data.size() - pos - 4)
+                break; // incomplete frame of an interrupted write
+            text += qUncompress((const uchar*) data.constData() + pos + 4, n);
+            pos += 4 + n;
+        }
+    }
+    else
+    {
+        format = OUT_TEXT;
+        text.swap(data);
+    }
+
+    // (the seeds are parsed in parallel, the other lines one by one)
+    std::vector<SeedTextLine> others;
+    parseSeedText(text.constData(), text.size(), 1, seeds, &others);
+    for (const SeedTextLine& o : others)
+    {
+        QByteArray ba = QByteArray(text.constData() + o.pos, o.len).trimmed();
+        QString line = QString::fromLocal8Bit(ba);
+        if (line.startsWith("#"))
+        {
+            if (line.startsWith("#Done"))
+                done = true;
+            else if (sscanf(ba.data(), "#Shard: %d/%d", &shardidx, &shardcnt) == 2)
+                continue;
+            else if (isSearchLine(line))
+                header.append(line);
+        }
+        else if (!line.isEmpty())
+        {
+            *err = QString("Failed to parse line %1 of \"%2\": %3").arg(o.lineno).arg(path, line);
+            return false;
+        }
+    }
+    hash = sessionHash(header);
+    return true;
 }
 
-Headless::Headless(QString sessionpath, QString resultspath, QObject *parent)
+Headless::Headless(QString sessionpath, QString resultspath, const HeadlessOpts& opts, QObject *parent)
     : QThread(parent)
     , sthread(nullptr)
     , sessionpath(sessionpath)
-    , resultfile(resultspath)
-    , resultstream(stdout)
+    , console(true)
+    , completed()
+    , listpath(opts.list)
+    , liststream(opts.liststream)
+    , stream()
+    , rescnt()
+    , resumed()
+    , output()
+    , cppath(opts.checkpoint)
+    , cpinterval(opts.cpinterval)
+    , resume(opts.resume)
+    , metrics(opts.metrics)
+    , metricspath(opts.metricspath)
+    , metricsinterval(opts.metricsinterval)
+    , lastprog(), lastend(), lastseed()
+    , lastmin(nan("")), lastavg(nan("")), lastmax(nan(""))
 {
     sthread.isdone = true;
 
+    if (metrics == METRICS_JSONL && metricspath.isEmpty())
+    {   // (a JSON lines stream on stdout must not be mixed with other text)
+        g_console_stderr = true;
+        setTermStderr(true);
+    }
+
     QSettings settings(APP_STRING, APP_STRING);
     g_extgen.load(settings);
+    // (the full Config requires a gui application for the fonts)
+    g_luabudget = settings.value("config/luaBudget", g_luabudget).toInt();
+    g_luaprofiling = settings.value("config/luaProfile", g_luaprofiling).toBool();
+    g_condstats = metrics != METRICS_NONE;
 
     if (!loadSession(sessionpath))
         return;
 
+    if (opts.shardcnt > 0)
+    {
+        session.sc.shardidx = opts.shardidx;
+        session.sc.shardcnt = opts.shardcnt;
+    }
+    if (opts.threads >= 0)
+        session.sc.threads = opts.threads;
+    if (stream)
+    {   // (the position in a stream cannot be restored)
+        if (session.sc.shardcnt > 1)
+            warn(nullptr, "Sharding is not supported for streamed seed lists.");
+        if (!cppath.isEmpty())
+            warn(nullptr, "Checkpoints are not supported for streamed seed lists.");
+        session.sc.shardidx = 0;
+        session.sc.shardcnt = 1;
+        cppath.clear();
+    }
+
     if (!sthread.set(nullptr, session))
         return;
+    sthread.stream = stream;
 
-    connect(&sthread, &SearchMaster::searchResult, this, &Headless::searchResult, Qt::QueuedConnection);
+    // (direct, so that the results of a completed item are always written
+    // before a checkpoint can include the item)
+    connect(&sthread, &SearchMaster::searchResult, this, &Headless::searchResult, Qt::DirectConnection);
     connect(&sthread, &SearchMaster::searchFinish, this, &Headless::searchFinish, Qt::QueuedConnection);
     connect(&timer, &QTimer::timeout, this, QOverload<>::of(&Headless::progressTimeout));
+    connect(&cptimer, &QTimer::timeout, this, &Headless::writeCheckpoint);
+    connect(&outtimer, &QTimer::timeout, this, &Headless::pollOutput);
+    connect(&metricstimer, &QTimer::timeout, this, &Headless::writeMetrics);
 
-    if (!resultfile.fileName().isEmpty())
-    {
-        if (resultfile.open(QIODevice::ReadWrite | QIODevice::Truncate | QIODevice::Text))
-            resultstream.setDevice(&resultfile);
+    int format = opts.outformat;
+    if (resume && !resultspath.isEmpty() && QFile::exists(resultspath))
+    {   // continue the results from before the checkpoint (in their format)
+        ResultFile rf;
+        QString err;
+        if (rf.read(resultspath, &err))
+        {
+            resumed.insert(rf.seeds.begin(), rf.seeds.end());
+            format = rf.format;
+        }
         else
-            warn(nullptr, "Output file for results coult not be created - using stdout instead.");
+        {
+            warn(nullptr, err);
+        }
     }
+    if (!output.open(resultspath, format, resume))
+        sthread.isdone = true;
 }
 
 Headless::~Headless()
 {
 }
 
-static bool load_seeds(std::vector<uint64_t>& seeds, QString path)
-{
-    QByteArray ba = path.toLocal8Bit();
-    uint64_t len;
-    if (uint64_t *l = loadSavedSeeds(ba.data(), &len))
-    {
-        seeds.assign(l, l+len);
-        free(l);
-        return true;
-    }
-    return false;
-}
-
 bool Headless::loadSession(QString sessionpath)
 {
     qOut() << "Loading session: \"" << sessionpath << "\"\n";
@@ -107,7 +463,27 @@ bool Headless::loadSession(QString sessionpath)
     }
     if (session.sc.searchtype == SEARCH_LIST)
     {
-        if (!load_seeds(session.slist, session.sc.slist64path))
+        if (!listpath.isEmpty())
+            session.sc.slist64path = listpath;
+        const QString& path = session.sc.slist64path;
+        if (liststream != LIST_LOAD || path == "-" || (QFile::exists(path) && !QFileInfo(path).isFile()))
+        {   // stdin, pipes and lists that are being written are read while searching
+            stream = new SeedStream(path, liststream == LIST_FOLLOW, this);
+            session.slist.clear();
+        }
+        else if (SeedMap::isBinary(path))
+        {   // binary lists are searched in place
+            std::shared_ptr<SeedMap> map(new SeedMap);
+            QString err;
+            if (!map->open(path, &err))
+            {
+                warn(nullptr, err);
+                return false;
+            }
+            session.slistmap = map;
+            session.slist.clear();
+        }
+        else if (!loadSeedList(session.slist, session.sc.slist64path))
         {
             warn(nullptr, QString("Failed to load 64-bit seed list:\n\"%1\"").arg(session.sc.slist64path));
             return false;
@@ -115,7 +491,7 @@ bool Headless::loadSession(QString sessionpath)
     }
     else if (session.gen48.mode == GEN48_LIST)
     {
-        if (!load_seeds(session.slist, session.gen48.slist48path))
+        if (!loadSeedList(session.slist, session.gen48.slist48path))
         {
             warn(nullptr, QString("Failed to load 48-bit seed list:\n\"%1\"").arg(session.gen48.slist48path));
             return false;
@@ -131,10 +507,20 @@ bool Headless::loadSession(QString sessionpath)
 
 void Headless::run()
 {
-    qOut() << "Condition summary:\n";
-    for (const Condition& cond : qAsConst(session.cv))
-        qOut() << cond.summary(false) << "\n";
+    if (console)
+    {
+        qOut() << "Condition summary:\n";
+        for (const Condition& cond : qAsConst(session.cv))
+            qOut() << cond.summary(false) << "\n";
+    }
 
+    if (resume && session.cp.done)
+    {
+        qOut() << "The search of this checkpoint is already complete.\n";
+        qOut().flush();
+        emit finished();
+        return;
+    }
     if (sthread.isdone)
     {
         qOut() << "Search parameters invalid or incomplete.\n";
@@ -143,16 +529,42 @@ void Headless::run()
         return;
     }
 
-    qOut() << "\nSearching for seeds...\n\n";
-    qOut().flush();
+    if (console)
+    {
+        qOut() << (resume ? "\nResuming search for seeds...\n\n" : "\nSearching for seeds...\n\n");
+        qOut().flush();
+        catchSignals();
+    }
 
-    session.writeHeader(resultstream);
-    resultstream.flush();
+    if (output.needsHeader())
+        output.writeHeader(session);
+    if (stream)
+        stream->start();
 
     sthread.startSearch();
     elapsed.start();
+    flushed.start();
+    outtimer.start(100);
+    if (!cppath.isEmpty())
+        cptimer.start(1000 * cpinterval);
+    if (metrics == METRICS_JSONL)
+    {
+        if (metricspath.isEmpty())
+            metricsfile.open(stdout, QIODevice::WriteOnly);
+        else
+        {
+            metricsfile.setFileName(metricspath);
+            if (!metricsfile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+                warn(nullptr, QString("Failed to open metrics file:\n%1").arg(metricsfile.errorString()));
+        }
+    }
+    if (metrics != METRICS_NONE)
+    {
+        metricsclock.start();
+        metricstimer.start(1000 * metricsinterval);
+    }
 
-    if (resultfile.isOpen())
+    if (console && output.isFile() && !g_console_stderr)
     {
         qOut() << "\n\n\n\n\n\n\n";
         qOut().flush();
@@ -162,20 +574,68 @@ void Headless::run()
 
 void Headless::searchResult(uint64_t seed)
 {
-    results.push_back(seed);
-    resultstream << (int64_t) seed << "\n";
-    resultstream.flush();
+    if (resumed.count(seed))
+        return; // was found before the checkpoint
+    rescnt++;
+    output.add(seed);
 }
 
 void Headless::searchFinish(bool done)
 {
+    if (stream)
+    {
+        stream->stopReading();
+        QString err = stream->error();
+        if (!err.isEmpty())
+        {
+            warn(nullptr, err);
+            done = false;
+        }
+    }
+    completed = done;
     if (timer.isActive())
     {
         timer.stop();
         progressTimeout();
     }
-    if (done)
+    outtimer.stop();
+    if (metricstimer.isActive())
+    {   // with the final counts
+        metricstimer.stop();
+        writeMetrics();
+    }
+    if (done && console)
         qOut() << "Search done!\n";
+    // a completion marker allows the shards to be merged
+    output.finish(done);
+    if (cptimer.isActive())
+    {   // (a stopped search keeps the checkpoint that preceded the stop)
+        cptimer.stop();
+        if (done)
+            writeCheckpoint();
+    }
+    if (!console)
+    {
+        emit finished();
+        return;
+    }
+    const SearchThreadEnv::ReseedStats& rs = sthread.reseeds;
+    if (rs.seed64 || rs.seed48 || rs.sha)
+    {
+        qOut() << "Generator reseeds: " << rs.seed64 << " (64-bit), "
+               << rs.seed48 << " (48-bit), " << rs.sha << " (hash only)\n";
+    }
+    for (const Condition& c : qAsConst(session.cv))
+    {
+        if (c.type != F_LUA)
+            continue;
+        LuaProfileOutput& lp = g_lua_profile[c.save];
+        QMutexLocker locker(&lp.mutex);
+        if (lp.hash != c.hash || !lp.prof.calls)
+            continue;
+        qOut() << "Lua profile of condition " << c.save << ":\n"
+               << formatLuaProfile(lp.prof, 8) << "\n";
+    }
     qOut() << "Stopping event loop.\n";
     qOut().flush();
     emit finished();
@@ -187,20 +647,27 @@ void Headless::progressTimeout()
     uint64_t prog, end, seed;
     qreal min, avg, max;
     sthread.getProgress(&status, &prog, &end, &seed, &min, &avg, &max);
+    showProgress(status, prog, end, seed);
+}
 
+void Headless::showProgress(const QString& status, uint64_t prog, uint64_t end, uint64_t seed)
+{
     short width = get_term_width();
     if (width <= 24)
         return;
 
-    qreal perc = (qreal) prog / end;
+    qreal perc = end ? (qreal) prog / end : 0;
 
     int cols = floor(perc * (width - 4) + 1e-6);
     qint64 sec = elapsed.elapsed() / 1000;
 
     QStringList l;
-    l += QString(" Found matching seeds:%1 ").arg(results.size(), width-23);
+    l += QString(" Found matching seeds:%1 ").arg(rescnt, width-23);
     l += QString(" Scheduled seed:%1 ").arg((int64_t)seed, width-17);
-    l += QString(" Progress:%1 ").arg(QString("%1 / %2 : %3%").arg(prog).arg(end).arg(100*perc, 5, 'f', 2), width-11);
+    if (stream) // (the size of the list is not known in advance)
+        l += QString(" Processed:%1 ").arg(QString("%1 of %2 read").arg(prog).arg(end), width-12);
+    else
+        l += QString(" Progress:%1 ").arg(QString("%1 / %2 : %3%").arg(prog).arg(end).arg(100*perc, 5, 'f', 2), width-11);
     l += QString(" [%1%2] ").arg("", cols, '#').arg("", width-cols-4, '-');
     l += QString(" %1").arg(status, 1-width);
     l += QString::asprintf(" %d:%02d:%02d", (int)(sec / 3600), (int)(sec / 60) % 60, (int)(sec % 60));
@@ -215,4 +682,657 @@ void Headless::progressTimeout()
     qOut().flush();
 }
 
+void Headless::getCheckpoint(uint64_t *seed, Checkpoint *cp)
+{
+    sthread.getCheckpoint(seed, cp);
+}
+
+void Headless::writeCheckpoint()
+{
+    uint64_t seed;
+    Checkpoint cp;
+    getCheckpoint(&seed, &cp);
+    // the results of the completed items have to reach the output first
+    output.flush();
+    flushed.start();
+    cp.results = resumed.size() + rescnt;
+
+    // (QSaveFile writes to a temporary file that replaces the checkpoint
+    // on commit, so a crash cannot leave a partial checkpoint behind)
+    QSaveFile file(cppath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        warn(nullptr, QString("Failed to write checkpoint:\n%1").arg(file.errorString()));
+        return;
+    }
+    QTextStream stream(&file);
+    uint64_t startseed = session.sc.startseed;
+    session.sc.startseed = seed;
+    session.writeHeader(stream);
+    session.sc.startseed = startseed;
+    cp.write(stream);
+    if (!file.commit())
+        warn(nullptr, QString("Failed to write checkpoint:\n%1").arg(file.errorString()));
+}
+
+void Headless::catchSignals()
+{
+    // interrupts stop the search after a last checkpoint, and SIGUSR1
+    // flushes the buffered results
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+#ifdef SIGUSR1
+    signal(SIGUSR1, onSignal);
+#endif
+}
+
+void Headless::stopSearch()
+{
+    if (cptimer.isActive())
+    {   // checkpoint while the workers still hold their items
+        writeCheckpoint();
+        cptimer.stop();
+    }
+    output.flush();
+    if (sthread.workers.empty())
+        searchFinish(false); // nothing to wait for
+    else
+        sthread.stopSearch();
+}
+
+void Headless::pollOutput()
+{
+    if (console && g_sigstop)
+    {
+        g_sigstop = 0;
+        qOut() << "Interrupted, stopping search...\n";
+        qOut().flush();
+        stopSearch();
+        return;
+    }
+    if ((console && g_sigflush) || flushed.elapsed() >= RESULTS_FLUSH)
+    {
+        if (console)
+            g_sigflush = 0;
+        output.flush();
+        flushed.start();
+    }
+}
+
+static QString jsonNum(qreal x)
+{
+    return std::isfinite(x) ? QString::number(x, 'f', 1) : QString("null");
+}
+
+static QString promNum(qreal x)
+{
+    return std::isfinite(x) ? QString::number(x, 'f', 1) : QString("NaN");
+}
+
+void Headless::writeMetrics()
+{
+    QString status;
+    uint64_t prog = lastprog, end = lastend, seed = lastseed;
+    qreal min = lastmin, avg = lastavg, max = lastmax;
+    // (while the search master is busy, the previous sample is repeated)
+    if (sthread.getProgress(&status, &prog, &end, &seed, &min, &avg, &max))
+    {
+        lastprog = prog;
+        lastend = end;
+        lastseed = seed;
+        lastmin = min;
+        lastavg = avg;
+        lastmax = max;
+    }
+
+    std::vector<uint64_t> nseeds;
+    std::vector<SearchThreadEnv::CondStats> cstats;
+    sthread.getStats(&nseeds, &cstats);
+
+    // throughput of each worker since the previous sample
+    qreal dt = 1e-3 * metricsclock.restart();
+    std::vector<qreal> rates;
+    for (size_t i = 0; i < nseeds.size(); i++)
+    {
+        uint64_t prev = i < lastnseeds.size() ? lastnseeds[i] : 0;
+        rates.push_back(dt > 0 && nseeds[i] >= prev ? (nseeds[i] - prev) / dt : nan(""));
+    }
+    lastnseeds = nseeds;
+
+    std::vector<int> ids; // enabled conditions
+    for (const Condition& c : qAsConst(session.cv))
+        if (!(c.meta & Condition::DISABLED) && c.save < (int) cstats.size())
+            ids.push_back(c.save);
+    uint64_t found = resumed.size() + rescnt;
+
+    if (metrics == METRICS_JSONL)
+    {
+        QStringList threads, conds;
+        for (qreal r : rates)
+            threads.append(jsonNum(r));
+        for (int id : ids)
+        {
+            conds.append(QString("{\"id\":%1,\"tests\":%2,\"fails\":%3}")
+                .arg(id).arg(cstats[id].tests).arg(cstats[id].fails));
+        }
+        QString js = QString(
+            "{\"time\":\"%1\",\"elapsed\":%2,\"progress\":%3,\"end\":%4,\"seed\":%5,"
+            "\"speed\":{\"min\":%6,\"avg\":%7,\"max\":%8},\"results\":%9,")
+            .arg(QDateTime::currentDateTimeUtc().toString(Qt::ISODate))
+            .arg(elapsed.elapsed() / 1000)
+            .arg(prog).arg(end).arg((int64_t) seed)
+            .arg(jsonNum(min), jsonNum(avg), jsonNum(max))
+            .arg(found);
+        js += QString("\"threads\":[%1],\"conditions\":[%2]}\n")
+            .arg(threads.join(","), conds.join(","));
+        metricsfile.write(js.toUtf8());
+        metricsfile.flush();
+        return;
+    }
+
+    QString pm;
+    QTextStream out(&pm);
+    out << "# HELP cubiomes_search_progress Search progress in units of the search space.\n"
+        << "# TYPE cubiomes_search_progress gauge\n"
+        << "cubiomes_search_progress " << prog << "\n"
+        << "# HELP cubiomes_search_end Size of the search space.\n"
+        << "# TYPE cubiomes_search_end gauge\n"
+        << "cubiomes_search_end " << end << "\n"
+        << "# HELP cubiomes_search_speed Search speed in seeds per second.\n"
+        << "# TYPE cubiomes_search_speed gauge\n"
+        << "cubiomes_search_speed{quantile=\"0.25\"} " << promNum(min) << "\n"
+        << "cubiomes_search_speed{quantile=\"0.5\"} " << promNum(avg) << "\n"
+        << "cubiomes_search_speed{quantile=\"0.75\"} " << promNum(max) << "\n"
+        << "# HELP cubiomes_search_results_total Matching seeds found.\n"
+        << "# TYPE cubiomes_search_results_total counter\n"
+        << "cubiomes_search_results_total " << found << "\n"
+        << "# HELP cubiomes_search_thread_seeds_total Seeds processed by each search thread.\n"
+        << "# TYPE cubiomes_search_thread_seeds_total counter\n";
+    for (size_t i = 0; i < nseeds.size(); i++)
+        out << "cubiomes_search_thread_seeds_total{thread=\"" << i << "\"} " << nseeds[i] << "\n";
+    out << "# HELP cubiomes_search_condition_tests_total Tests of each condition.\n"
+        << "# TYPE cubiomes_search_condition_tests_total counter\n";
+    for (int id : ids)
+        out << "cubiomes_search_condition_tests_total{condition=\"" << id << "\"} " << cstats[id].tests << "\n";
+    out << "# HELP cubiomes_search_condition_fails_total Failed tests of each condition.\n"
+        << "# TYPE cubiomes_search_condition_fails_total counter\n";
+    for (int id : ids)
+        out << "cubiomes_search_condition_fails_total{condition=\"" << id << "\"} " << cstats[id].fails << "\n";
+    out.flush();
+
+    // (the collector must never see a partial file)
+    QSaveFile file(metricspath);
+    if (file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        file.write(pm.toUtf8());
+        file.commit();
+    }
+}
+
+int mergeShards(const QStringList& inputs, const QString& outpath)
+{
+    QStringList header; // session header that the shards have in common
+    uint64_t hash = 0;
+    int shardcnt = 0;
+    std::vector<char> shards;
+    std::vector<uint64_t> seeds;
+    bool ok = true;
+
+    for (const QString& path : inputs)
+    {
+        ResultFile rf;
+        QString err;
+        if (!rf.read(path, &err))
+        {
+            qOut() << err << "\n";
+            return 1;
+        }
+        int idx = rf.shardidx, cnt = rf.shardcnt;
+        bool done = rf.done;
+        seeds.insert(seeds.end(), rf.seeds.begin(), rf.seeds.end());
+
+        if (shardcnt == 0)
+        {
+            hash = rf.hash;
+            shardcnt = cnt;
+            shards.assign(cnt, 0);
+        }
+        if (header.isEmpty())
+            header = rf.header; // (binary results only keep the hash)
+        if (rf.hash != hash)
+        {
+            qOut() << "Session of \"" << path << "\" does not match the first input.\n";
+            return 1;
+        }
+        if (cnt != shardcnt || idx < 0 || idx >= cnt)
+        {
+            qOut() << "Shard " << idx << "/" << cnt << " of \"" << path
+                   << "\" does not match " << shardcnt << " shards.\n";
+            return 1;
+        }
+        if (shards[idx]++)
+        {
+            qOut() << "Shard " << idx << " is given more than once.\n";
+            ok = false;
+        }
+        if (!done)
+        {
+            qOut() << "Shard " << idx << " in \"" << path << "\" is incomplete.\n";
+            ok = false;
+        }
+    }
+    for (int i = 0; i < shardcnt; i++)
+    {
+        if (!shards[i])
+        {
+            qOut() << "Shard " << i << "/" << shardcnt << " is missing.\n";
+            ok = false;
+        }
+    }
+    if (!ok || shardcnt == 0)
+    {
+        qOut() << "The shards do not cover the search space.\n";
+        return 1;
+    }
+
+    std::sort(seeds.begin(), seeds.end());
+    seeds.erase(std::unique(seeds.begin(), seeds.end()), seeds.end());
+
+    QFile outfile(outpath);
+    QTextStream out(stdout);
+    if (!outpath.isEmpty())
+    {
+        if (!outfile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        {
+            qOut() << "Failed to create: \"" << outpath << "\"\n";
+            return 1;
+        }
+        out.setDevice(&outfile);
+    }
+    for (const QString& line : qAsConst(header))
+        out << line << "\n";
+    for (uint64_t s : seeds)
+        out << (int64_t) s << "\n";
+    out << "#Done\n";
+    out.flush();
+
+    qOut() << "Merged " << seeds.size() << " seeds from " << shardcnt << " shards.\n";
+    qOut().flush();
+    return 0;
+}
+
+static bool writeSeeds(QSaveFile& out, const uint64_t *seeds, size_t n)
+{
+    std::vector<char> buf(8 * n);
+    for (size_t i = 0; i < n; i++)
+        putLE(&buf[8*i], seeds[i], 8);
+    return out.write(buf.data(), buf.size()) == (qint64) buf.size();
+}
+
+int convertSeedList(const QStringList& inputs, const QString& outpath, bool sort)
+{
+    if (outpath.isEmpty())
+    {
+        qOut() << "The binary seed list needs an --out file.\n";
+        return 1;
+    }
+    QSaveFile out(outpath);
+    if (!out.open(QIODevice::WriteOnly))
+    {
+        qOut() << "Failed to create: \"" << outpath << "\"\n";
+        return 1;
+    }
+    // (the list is not the output of a session, so it has no session hash)
+    char h[32] = "CVSEEDS";
+    putLE(h+8, 0, 8);
+    putLE(h+16, 0, 4);
+    putLE(h+20, 1, 4);
+    putLE(h+24, RESULTS_DONE | (sort ? RESULTS_SORTED : 0), 4);
+    bool ok = out.write(h, sizeof(h)) == (qint64) sizeof(h);
+
+    std::vector<uint64_t> seeds; // to be sorted
+    uint64_t cnt = 0;
+    for (const QString& path : inputs)
+    {
+        QFile file(path);
+        QByteArray magic;
+        if (file.open(QIODevice::ReadOnly))
+            magic = file.read(8);
+        file.close();
+
+        if (magic.startsWith("CVSEED"))
+        {   // binary or compressed results
+            ResultFile rf;
+            QString err;
+            if (!rf.read(path, &err))
+            {
+                qOut() << err << "\n";
+                return 1;
+            }
+            if (sort)
+                seeds.insert(seeds.end(), rf.seeds.begin(), rf.seeds.end());
+            else
+                ok &= writeSeeds(out, rf.seeds.data(), rf.seeds.size());
+            cnt += rf.seeds.size();
+            continue;
+        }
+
+        // text lists are streamed, so they do not have to fit into memory
+        SeedStream stream(path, false);
+        stream.start();
+        SeedStream::Chunk chunk;
+        while (!stream.atEnd())
+        {
+            if (!stream.take(&chunk, 100))
+                continue;
+            const std::vector<uint64_t>& v = *chunk.seeds;
+            if (sort)
+                seeds.insert(seeds.end(), v.begin(), v.end());
+            else
+                ok &= writeSeeds(out, v.data(), v.size());
+            cnt += v.size();
+        }
+        if (!stream.error().isEmpty())
+        {
+            qOut() << stream.error() << "\n";
+            return 1;
+        }
+    }
+
+    if (sort)
+    {
+        std::sort(seeds.begin(), seeds.end(), [](uint64_t a, uint64_t b) {
+            return (int64_t) a < (int64_t) b;
+        });
+        seeds.erase(std::unique(seeds.begin(), seeds.end()), seeds.end());
+        ok &= writeSeeds(out, seeds.data(), seeds.size());
+        cnt = seeds.size();
+    }
+    if (!ok || !out.commit())
+    {
+        qOut() << "Failed to write: \"" << outpath << "\"\n";
+        return 1;
+    }
+
+    qOut() << "Converted " << cnt << " seeds to \"" << outpath << "\".\n";
+    qOut().flush();
+    return 0;
+}
+
+
+JobQueue::JobQueue(const HeadlessOpts& opts, QString outdir, QObject *parent)
+    : QObject(parent)
+    , opts(opts)
+    , outdir(outdir)
+    , poolsize(QThread::idealThreadCount())
+    , jobs()
+    , stopping()
+    , ended()
+{
+    // (the jobs cannot share a checkpoint, a seed list or a metrics output)
+    this->opts.checkpoint.clear();
+    this->opts.list.clear();
+    this->opts.resume = false;
+    this->opts.metrics = METRICS_NONE;
+    if (poolsize < 1)
+        poolsize = 1;
+    connect(&polltimer, &QTimer::timeout, this, &JobQueue::pollSignals);
+}
+
+JobQueue::~JobQueue()
+{
+}
+
+bool JobQueue::load(const QString& path)
+{
+    std::vector<std::pair<int, QString>> entries; // (priority, session)
+    QFileInfo info(path);
+    if (info.isDir())
+    {
+        QDir dir(path);
+        QStringList files = dir.entryList(QStringList("*.session"), QDir::Files, QDir::Name);
+        for (const QString& f : qAsConst(files))
+            entries.push_back(std::make_pair(1, dir.filePath(f)));
+    }
+    else
+    {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        {
+            warn(nullptr, QString("Failed to open job list:\n\"%1\"").arg(path));
+            return false;
+        }
+        QDir dir = info.dir();
+        QTextStream stream(&file);
+        for (int lineno = 1; !stream.atEnd(); lineno++)
+        {
+            QString line = stream.readLine().trimmed();
+            if (line.isEmpty() || line.startsWith("#"))
+                continue;
+            int priority = 1;
+            int sep = line.indexOf(QRegularExpression("\\s"));
+            if (sep > 0)
+            {
+                bool ok;
+                int p = line.left(sep).toInt(&ok);
+                if (ok)
+                {
+                    priority = p;
+                    line = line.mid(sep).trimmed();
+                }
+            }
+            if (priority < 1)
+            {
+                warn(nullptr, QString("Invalid priority on line %1 of the job list.").arg(lineno));
+                return false;
+            }
+            entries.push_back(std::make_pair(priority, dir.filePath(line)));
+        }
+    }
+    if (entries.empty())
+    {
+        warn(nullptr, QString("No jobs found in:\n\"%1\"").arg(path));
+        return false;
+    }
+    if (!outdir.isEmpty() && !QDir(outdir).exists() && !QDir().mkpath(outdir))
+    {
+        warn(nullptr, QString("Failed to create output directory:\n\"%1\"").arg(outdir));
+        return false;
+    }
+
+    for (const auto& e : entries)
+    {
+        QFileInfo si(e.second);
+        SearchJob job;
+        job.sessionpath = e.second;
+        job.resultspath = QDir(outdir.isEmpty() ? si.path() : outdir).filePath(si.completeBaseName() + ".out");
+        job.priority = e.first;
+        job.state = SearchJob::QUEUED;
+        job.search = nullptr;
+        job.rescnt = 0;
+        job.msec = 0;
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+void JobQueue::run()
+{
+    qOut() << "Running " << jobs.size() << " jobs with " << poolsize << " threads.\n";
+    qOut().flush();
+    Headless::catchSignals();
+    polltimer.start(100);
+    schedule();
+}
+
+void JobQueue::schedule()
+{
+    if (stopping || ended)
+        return;
+
+    int avail = poolsize;
+    for (SearchJob& job : jobs)
+        if (job.state == SearchJob::RUNNING)
+            avail -= job.search->sthread.activeWorkers();
+
+    while (avail > 0)
+    {
+        // hand out the free threads one at a time to the job that would have
+        // the fewest threads per priority, among those that can use more
+        std::vector<int> cnt(jobs.size(), -1);
+        std::vector<int> grant(jobs.size(), 0);
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            SearchJob& job = jobs[i];
+            if (job.state == SearchJob::QUEUED)
+                cnt[i] = 0;
+            else if (job.state == SearchJob::RUNNING)
+            {
+                SearchMaster& master = job.search->sthread;
+                QMutexLocker locker(&master.mutex);
+                if (!master.isdone && !master.stop)
+                    cnt[i] = master.activeWorkers();
+            }
+        }
+        for (int n = 0; n < avail; n++)
+        {
+            int best = -1;
+            for (int i = 0; i < (int) jobs.size(); i++)
+            {
+                if (cnt[i] < 0)
+                    continue;
+                if (best < 0)
+                {
+                    best = i;
+                    continue;
+                }
+                qint64 a = (qint64) (cnt[i] + 1) * jobs[best].priority;
+                qint64 b = (qint64) (cnt[best] + 1) * jobs[i].priority;
+                if (a < b || (a == b && jobs[i].priority > jobs[best].priority))
+                    best = i;
+            }
+            if (best < 0)
+                break;
+            cnt[best]++;
+            grant[best]++;
+        }
+
+        int started = 0;
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            if (grant[i] == 0)
+                continue;
+            if (jobs[i].state == SearchJob::QUEUED)
+            {
+                if (startJob(jobs[i], grant[i]))
+                    started += grant[i];
+            }
+            else if (jobs[i].state == SearchJob::RUNNING)
+            {
+                started += jobs[i].search->sthread.addWorkers(grant[i]);
+            }
+        }
+        if (started == 0)
+            break;
+        avail -= started;
+    }
+}
+
+bool JobQueue::startJob(SearchJob& job, int threads)
+{
+    int num = (int) (&job - jobs.data()) + 1;
+    qOut() << QString("Starting job %1/%2: \"%3\" (priority %4, %5 threads)\n")
+        .arg(num).arg(jobs.size()).arg(job.sessionpath).arg(job.priority).arg(threads);
+    qOut().flush();
+
+    Headless *search = new Headless(job.sessionpath, job.resultspath, opts, this);
+    search->console = false;
+    search->sthread.threadcnt = threads;
+    search->sthread.autothreads = false; // (the pool decides)
+    job.search = search;
+    job.state = SearchJob::RUNNING;
+    connect(search, &Headless::finished, this, &JobQueue::onJobFinished);
+    // (queued, to hand the thread of a finished worker to the next job
+    // outside of the search master)
+    connect(&search->sthread, &SearchMaster::workerFinished, this, &JobQueue::schedule, Qt::QueuedConnection);
+    search->run(); // may finish right away
+    return job.state == SearchJob::RUNNING;
+}
+
+void JobQueue::onJobFinished()
+{
+    Headless *search = qobject_cast<Headless*>(sender());
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        SearchJob& job = jobs[i];
+        if (!search || job.search != search)
+            continue;
+        const char *state = search->completed ? "done" : stopping ? "stopped" : "failed";
+        job.state = search->completed ? SearchJob::DONE : SearchJob::FAILED;
+        job.rescnt = search->rescnt;
+        job.msec = search->elapsed.isValid() ? search->elapsed.elapsed() : 0;
+        job.search = nullptr;
+        search->disconnect(this);
+        search->sthread.disconnect(this);
+        search->deleteLater();
 
+        qint64 sec = job.msec / 1000;
+        qOut() << QString("Job %1/%2 %3: \"%4\" (%5 seeds in %6)\n")
+            .arg(i+1).arg(jobs.size()).arg(state, job.resultspath).arg(job.rescnt)
+            .arg(QString::asprintf("%d:%02d:%02d", (int)(sec / 3600), (int)(sec / 60) % 60, (int)(sec % 60)));
+        qOut().flush();
+    }
+    checkDone();
+}
+
+void JobQueue::checkDone()
+{
+    int running = 0, queued = 0, done = 0;
+    for (const SearchJob& job : jobs)
+    {
+        running += job.state == SearchJob::RUNNING;
+        queued += job.state == SearchJob::QUEUED;
+        done += job.state == SearchJob::DONE;
+    }
+    if (running > 0 || ended)
+        return;
+    if (queued > 0 && !stopping)
+    {   // (not from within a job that finished while it was started)
+        QTimer::singleShot(0, this, SLOT(schedule()));
+        return;
+    }
+    ended = true;
+    polltimer.stop();
+    qOut() << "Jobs done: " << done << " of " << jobs.size();
+    if (queued > 0)
+        qOut() << " (" << queued << " not started)";
+    qOut() << "\n";
+    qOut().flush();
+    emit finished();
+}
+
+void JobQueue::pollSignals()
+{
+    if (g_sigstop && !stopping)
+    {
+        g_sigstop = 0;
+        stopping = true;
+        qOut() << "Interrupted, stopping jobs...\n";
+        qOut().flush();
+        std::vector<Headless*> running;
+        for (SearchJob& job : jobs)
+            if (job.state == SearchJob::RUNNING)
+                running.push_back(job.search);
+        for (Headless *search : running)
+            search->stopSearch();
+        checkDone();
+        return;
+    }
+    if (g_sigflush)
+    {
+        g_sigflush = 0;
+        for (SearchJob& job : jobs)
+            if (job.state == SearchJob::RUNNING)
+                job.search->output.flush();
+    }
+}
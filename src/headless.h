@@ -7,21 +7,143 @@
 #include <QElapsedTimer>
 #include <QFile>
 
+#include <unordered_set>
+
+// Interval (in seconds) at which the workers of a distributed search signal
+// the coordinator that they are still alive.
+#define PING_INTERVAL   5
+
+class SeedStream;
+
+// How a headless list search reads its 64-bit seed list: loaded before the
+// search starts, or streamed while searching, optionally following a file
+// that is still being written (see SeedStream).
+enum { LIST_LOAD, LIST_STREAM, LIST_FOLLOW };
+
+// options of the headless mode from the command line
+struct HeadlessOpts
+{
+    int shardidx, shardcnt; // search shard (shardcnt = 0: as in the session)
+    QString serve;          // coordinate a distributed search at this address
+    QString connect;        // work for the coordinator at this address
+    int leasetimeout;       // seconds until the leases of a silent worker expire
+    QString checkpoint;     // periodically save the progress to this file
+    int cpinterval;         // seconds between checkpoints
+    bool resume;            // the session is a checkpoint to be resumed
+    int outformat;          // format of the results output
+    int metrics;            // format of the metrics output
+    QString metricspath;    // file for the metrics (jsonl: stdout if empty)
+    int metricsinterval;    // seconds between metrics samples
+    int threads;            // worker threads (-1: as in the session, 0: auto)
+    QString list;           // 64-bit seed list (instead of the session's)
+    int liststream;         // how the list is read
+    HeadlessOpts()
+        : shardidx(), shardcnt(), serve(), connect(), leasetimeout(60)
+        , checkpoint(), cpinterval(60), resume(), outformat()
+        , metrics(), metricspath(), metricsinterval(10), threads(-1)
+        , list(), liststream() {}
+};
+
+// Formats for the metrics of a headless search:
+//  METRICS_JSONL   appends one JSON object per sample
+//  METRICS_PROM    replaces a file in the Prometheus text format (for the
+//                  textfile collector of the node exporter)
+enum { METRICS_NONE, METRICS_JSONL, METRICS_PROM };
+
+// Output formats for the results of a headless search:
+//  OUT_TEXT        session header and the seeds as decimal lines
+//  OUT_BINARY      header (see below) and the seeds as little-endian uint64
+//  OUT_COMPRESSED  the text format in compressed frames (see below)
+enum { OUT_TEXT, OUT_BINARY, OUT_COMPRESSED };
+
+// The binary format starts with a header of 32 bytes (little-endian):
+//  char[8] "CVSEEDS", uint64 session hash, int32 shardidx, int32 shardcnt,
+//  uint32 flags, uint32 reserved
+// The compressed format starts with "CVSEEDZ" (8 bytes) followed by
+// frames of a uint32 size and the text output compressed by qCompress().
+// The binary format doubles as the binary seed list format (see SeedMap).
+#define RESULTS_DONE    0x1     // flag for a completed search
+#define RESULTS_SORTED  0x2     // flag for seeds in ascending (signed) order
+
+// Results are buffered up to this size, or the flush interval (in msec).
+#define RESULTS_BUFSIZ  (1 << 16)
+#define RESULTS_FLUSH   1000
+
+class ResultWriter
+{
+public:
+    ResultWriter();
+
+    // Opens the output (stdout if the path is empty), continuing after the
+    // existing results if append is set. Only the text format can be written
+    // to stdout.
+    bool open(const QString& path, int format, bool append);
+    bool isFile() const { return tofile; }
+    // The header is needed unless results are appended to an output.
+    bool needsHeader() { return !tofile || file.size() == 0; }
+
+    void writeHeader(Session& session);
+    void add(uint64_t seed);
+    void flush();
+    void finish(bool done);
+
+private:
+    qint64 completeSize();
+
+public:
+    QFile file;
+    int format;
+    bool tofile;
+    QByteArray buf;
+};
+
+// Results of a headless search that are read back from an output.
+struct ResultFile
+{
+    int format;
+    QStringList header;     // session lines that define the search
+    uint64_t hash;          // session hash (as in the binary format)
+    int shardidx, shardcnt;
+    bool done;
+    std::vector<uint64_t> seeds;
+
+    ResultFile() : format(), header(), hash(), shardidx(), shardcnt(1), done(), seeds() {}
+    bool read(const QString& path, QString *err);
+};
+
+// Merges the outputs of the shards of a headless search into one result
+// file, after verifying that the shards cover the whole search space.
+int mergeShards(const QStringList& inputs, const QString& outpath);
+
+// Converts seed lists (text or results in any output format) into one binary
+// seed list that can be memory-mapped by a list search, optionally sorted
+// with the duplicates removed.
+int convertSeedList(const QStringList& inputs, const QString& outpath, bool sort);
+
 class Headless : public QThread
 {
     Q_OBJECT
 
 public:
-    Headless(QString sessionpath, QString resultspath, QObject *parent = 0);
+    Headless(QString sessionpath, QString resultspath, const HeadlessOpts& opts, QObject *parent = 0);
     virtual ~Headless();
 
     bool loadSession(QString sessionpath);
+    void showProgress(const QString& status, uint64_t prog, uint64_t end, uint64_t seed);
+    static void catchSignals();
+    // Stops the search after a last checkpoint.
+    void stopSearch();
+    // Takes a snapshot of the search progress for a checkpoint.
+    virtual void getCheckpoint(uint64_t *seed, Checkpoint *cp);
 
 public slots:
     void run();
     void searchResult(uint64_t seed);
     void searchFinish(bool done);
-    void progressTimeout();
+    virtual void progressTimeout();
+    void writeCheckpoint();
+    void pollOutput();
+    void writeMetrics();
 
 signals:
     void finished();
@@ -30,11 +152,85 @@ public:
     SearchMaster sthread;
     QString sessionpath;
     Session session;
-    std::vector<uint64_t> results;
-    QFile resultfile;
-    QTextStream resultstream;
+    bool console;           // reports to the console and handles the signals
+    bool completed;         // the search finished the whole search space
+    QString listpath;
+    int liststream;
+    SeedStream *stream;     // of a streamed list search
+    uint64_t rescnt;
+    std::unordered_set<uint64_t> resumed; // results from before the resume
+    ResultWriter output;
+    QTimer outtimer;
+    QElapsedTimer flushed;
     QTimer timer;
     QElapsedTimer elapsed;
+    QString cppath;
+    int cpinterval;
+    bool resume;
+    QTimer cptimer;
+    int metrics;
+    QString metricspath;
+    int metricsinterval;
+    QFile metricsfile;
+    QTimer metricstimer;
+    QElapsedTimer metricsclock;
+    std::vector<uint64_t> lastnseeds; // worker counts of the previous sample
+    uint64_t lastprog, lastend, lastseed; // progress of the previous sample
+    qreal lastmin, lastavg, lastmax;
+};
+
+// A search session of a job queue.
+struct SearchJob
+{
+    enum { QUEUED, RUNNING, DONE, FAILED };
+
+    QString sessionpath;
+    QString resultspath;
+    int priority;           // share of the worker pool relative to other jobs
+    int state;
+    Headless *search;       // while running
+    uint64_t rescnt;
+    qint64 msec;            // run time
+};
+
+// Runs the sessions of a job directory (*.session files) or list file
+// concurrently with one pool of worker threads. Each job has its own search
+// master and output, and is given threads in proportion to its priority, so
+// the threads that become idle at the end of a search are handed to the
+// other jobs right away.
+// The lines of a list file name a session, optionally preceded by a
+// priority (default: 1). Relative paths are relative to the list file.
+class JobQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    JobQueue(const HeadlessOpts& opts, QString outdir, QObject *parent = 0);
+    virtual ~JobQueue();
+
+    bool load(const QString& path);
+
+public slots:
+    void run();
+    void schedule();
+    void onJobFinished();
+    void pollSignals();
+
+signals:
+    void finished();
+
+private:
+    bool startJob(SearchJob& job, int threads);
+    void checkDone();
+
+public:
+    HeadlessOpts opts;      // of the job searches
+    QString outdir;         // for the outputs (default: next to the sessions)
+    int poolsize;
+    std::vector<SearchJob> jobs;
+    bool stopping;
+    bool ended;
+    QTimer polltimer;
 };
 
 #endif // HEADLESS_H
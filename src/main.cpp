@@ -1,6 +1,10 @@
 #include "aboutdialog.h"
 #include "headless.h"
 #include "mainwindow.h"
+#include "workerpolicy.h"
+#if WITH_DISTRIBUTED
+#include "searchserver.h"
+#endif
 
 #include "cubiomes/util.h"
 
@@ -36,8 +40,14 @@ int main(int argc, char *argv[])
     bool nogui = false;
     bool reset = false;
     bool usage = false;
+    bool merge = false;
+    bool convert = false;
+    bool sortlist = false;
     QString sessionpath;
     QString resultspath;
+    QString jobspath;
+    QStringList inputs;
+    HeadlessOpts opts;
 
     for (int i = 1; i < argc; i++)
     {
@@ -55,8 +65,135 @@ int main(int argc, char *argv[])
             resultspath = argv[i] + 6;
         else if (strncmp(argv[i], "--out", 5) == 0 && i+1 < argc)
             resultspath = argv[++i];
+        else if (strncmp(argv[i], "--shard=", 8) == 0)
+        {
+            if (sscanf(argv[i] + 8, "%d/%d", &opts.shardidx, &opts.shardcnt) != 2 ||
+                opts.shardcnt < 1 || opts.shardidx < 0 || opts.shardidx >= opts.shardcnt)
+            {
+                fprintf(stderr, "Invalid shard \"%s\", expected i/n with 0 <= i < n.\n", argv[i] + 8);
+                exit(1);
+            }
+        }
+        else if (strncmp(argv[i], "--serve=", 8) == 0)
+            opts.serve = argv[i] + 8;
+        else if (strncmp(argv[i], "--connect=", 10) == 0)
+            opts.connect = argv[i] + 10;
+        else if (strncmp(argv[i], "--lease-timeout=", 16) == 0)
+        {
+            opts.leasetimeout = atoi(argv[i] + 16);
+            if (opts.leasetimeout < 2 * PING_INTERVAL)
+            {
+                fprintf(stderr, "The lease timeout should be at least %d seconds.\n", 2 * PING_INTERVAL);
+                exit(1);
+            }
+        }
+        else if (strncmp(argv[i], "--checkpoint=", 13) == 0)
+            opts.checkpoint = argv[i] + 13;
+        else if (strncmp(argv[i], "--checkpoint-interval=", 22) == 0)
+        {
+            opts.cpinterval = atoi(argv[i] + 22);
+            if (opts.cpinterval < 1)
+            {
+                fprintf(stderr, "Invalid checkpoint interval \"%s\".\n", argv[i] + 22);
+                exit(1);
+            }
+        }
+        else if (strncmp(argv[i], "--resume=", 9) == 0)
+        {
+            sessionpath = argv[i] + 9;
+            opts.resume = true;
+        }
+        else if (strncmp(argv[i], "--out-format=", 13) == 0)
+        {
+            const char *fmt = argv[i] + 13;
+            if (strcmp(fmt, "text") == 0)
+                opts.outformat = OUT_TEXT;
+            else if (strcmp(fmt, "binary") == 0)
+                opts.outformat = OUT_BINARY;
+            else if (strcmp(fmt, "compressed") == 0)
+                opts.outformat = OUT_COMPRESSED;
+            else
+            {
+                fprintf(stderr, "Unknown output format \"%s\".\n", fmt);
+                exit(1);
+            }
+        }
+        else if (strncmp(argv[i], "--metrics=", 10) == 0)
+        {
+            const char *fmt = argv[i] + 10;
+            if (strcmp(fmt, "jsonl") == 0)
+                opts.metrics = METRICS_JSONL;
+            else if (strcmp(fmt, "prom") == 0)
+                opts.metrics = METRICS_PROM;
+            else
+            {
+                fprintf(stderr, "Unknown metrics format \"%s\".\n", fmt);
+                exit(1);
+            }
+        }
+        else if (strncmp(argv[i], "--metrics-out=", 14) == 0)
+            opts.metricspath = argv[i] + 14;
+        else if (strncmp(argv[i], "--metrics-interval=", 19) == 0)
+        {
+            opts.metricsinterval = atoi(argv[i] + 19);
+            if (opts.metricsinterval < 1)
+            {
+                fprintf(stderr, "Invalid metrics interval \"%s\".\n", argv[i] + 19);
+                exit(1);
+            }
+        }
+        else if (strncmp(argv[i], "--list=", 7) == 0)
+            opts.list = argv[i] + 7;
+        else if (strcmp(argv[i], "--stream") == 0)
+            opts.liststream = LIST_STREAM;
+        else if (strcmp(argv[i], "--follow") == 0)
+            opts.liststream = LIST_FOLLOW;
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+        {
+            const char *arg = argv[i] + 10;
+            opts.threads = strcmp(arg, "auto") == 0 ? 0 : atoi(arg);
+            if (opts.threads < 1 && strcmp(arg, "auto") != 0)
+            {
+                fprintf(stderr, "Invalid number of threads \"%s\".\n", arg);
+                exit(1);
+            }
+        }
+        else if (strncmp(argv[i], "--affinity=", 11) == 0)
+        {
+            if (!g_workerpolicy.parseAffinity(argv[i] + 11))
+            {
+                fprintf(stderr, "Invalid affinity \"%s\".\n", argv[i] + 11);
+                exit(1);
+            }
+        }
+        else if (strncmp(argv[i], "--numa=", 7) == 0)
+        {
+            if (!g_workerpolicy.parseNuma(argv[i] + 7))
+            {
+                fprintf(stderr, "Unknown NUMA placement \"%s\".\n", argv[i] + 7);
+                exit(1);
+            }
+        }
+        else if (strncmp(argv[i], "--nice=", 7) == 0)
+        {
+            if (!g_workerpolicy.parseNice(argv[i] + 7))
+            {
+                fprintf(stderr, "Invalid nice value \"%s\".\n", argv[i] + 7);
+                exit(1);
+            }
+        }
+        else if (strncmp(argv[i], "--jobs=", 7) == 0)
+            jobspath = argv[i] + 7;
+        else if (strcmp(argv[i], "--merge") == 0)
+            merge = true;
+        else if (strcmp(argv[i], "--convert-list") == 0)
+            convert = true;
+        else if (strcmp(argv[i], "--sort") == 0)
+            sortlist = true;
         else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
             usage = true;
+        else if (argv[i][0] != '-')
+            inputs.append(argv[i]);
     }
 
     if (usage)
@@ -70,6 +207,67 @@ int main(int argc, char *argv[])
                 "      --reset-all            Clear settings and remove all session data.\n"
                 "      --session=file         Open this session file.\n"
                 "      --out=file             Write matching seeds to this file while searching.\n"
+                "      --out-format=fmt       Format of the --out file: text (default), binary\n"
+                "                             (little-endian 64-bit seeds) or compressed text.\n"
+                "                             Results are flushed every second, or on SIGUSR1.\n"
+                "      --shard=i/n            Search only shard i of n interleaved parts of the\n"
+                "                             search space (with --nogui).\n"
+                "      --checkpoint=file      Periodically save the search progress to this file\n"
+                "                             (with --nogui or --serve).\n"
+                "      --checkpoint-interval=N\n"
+                "                             Seconds between checkpoints (default: 60).\n"
+                "      --resume=file          Continue the search of a checkpoint, appending to\n"
+                "                             the --out file (implies --nogui).\n"
+                "      --metrics=fmt          Report the progress, speed and condition statistics\n"
+                "                             of a --nogui search periodically, either as JSON\n"
+                "                             lines (jsonl) or in the Prometheus text format\n"
+                "                             (prom).\n"
+                "      --metrics-out=file     File for the metrics (jsonl: appended, default\n"
+                "                             stdout; prom: replaced, required). The jsonl\n"
+                "                             metrics on stdout need the --out file and move\n"
+                "                             the console text to stderr.\n"
+                "      --metrics-interval=sec Seconds between metrics samples (default: 10).\n"
+                "      --jobs=path            Run the sessions of a job list, or the *.session\n"
+                "                             files of a directory, with one pool of threads.\n"
+                "                             The lines of a job list are a session path,\n"
+                "                             optionally preceded by a priority (default: 1).\n"
+                "                             The results of each session are written to\n"
+                "                             <name>.out in the --out directory (default: next\n"
+                "                             to the session). Implies --nogui.\n"
+                "      --list=path            Seed list of a --nogui list search (instead of the\n"
+                "                             one in the session), or - for stdin. Lines that\n"
+                "                             start with # are skipped, so the text output of\n"
+                "                             another search can be used. Binary lists (see\n"
+                "                             --convert-list) are searched in place.\n"
+                "      --stream               Read the seed list while searching, rather than\n"
+                "                             loading it first (implied for stdin and pipes).\n"
+                "      --follow               Stream a seed list that is still being written,\n"
+                "                             until a #Done line (as written by a completed\n"
+                "                             search).\n"
+                "      --threads=N            Number of search threads, or auto to settle on the\n"
+                "                             fastest number by measuring a few (default: as\n"
+                "                             in the session).\n"
+                "      --affinity=how         Pin the search threads to cpus: compact (fill one\n"
+                "                             NUMA node at a time), scatter (alternate between\n"
+                "                             nodes) or a cpu list such as 0-7,16-23.\n"
+                "      --numa=how             Keep the memory of each search thread on its node\n"
+                "                             (local) or spread it across nodes (interleave).\n"
+                "      --nice=N               Run the search threads with niceness N (1-19), or\n"
+                "                             only on otherwise idle cpus (idle).\n"
+                "      --merge files...       Merge the outputs of all shards of a search into\n"
+                "                             the --out file (or stdout).\n"
+                "      --convert-list files...\n"
+                "                             Convert seed lists (text or results) into one\n"
+                "                             binary list in the --out file, which list\n"
+                "                             searches map into memory instead of loading.\n"
+                "      --sort                 Sort the converted list and remove duplicates.\n"
+                "      --serve=addr           Coordinate a distributed search of the session by\n"
+                "                             handing out work to the workers that connect to\n"
+                "                             addr, either host:port (TCP) or a local socket.\n"
+                "      --connect=addr         Work for the coordinator at addr, using all cores.\n"
+                "                             (The workers need the same Lua scripts.)\n"
+                "      --lease-timeout=sec    Reissue the work of a worker that has been silent\n"
+                "                             for this long (default: 60).\n"
                 "\n";
         printf("%s", msg);
         exit(0);
@@ -102,10 +300,81 @@ int main(int argc, char *argv[])
         sessionpath = path + "/session.save";
     }
 
+    if (opts.resume)
+    {
+        nogui = true;
+        if (opts.checkpoint.isEmpty())
+            opts.checkpoint = sessionpath;
+    }
+
+    if (opts.metrics == METRICS_PROM && opts.metricspath.isEmpty())
+    {
+        fprintf(stderr, "The prom metrics format requires --metrics-out=file.\n");
+        exit(1);
+    }
+    if (opts.metrics == METRICS_JSONL && opts.metricspath.isEmpty() &&
+        resultspath.isEmpty() && jobspath.isEmpty())
+    {   // (the results would be written to stdout as well)
+        fprintf(stderr, "The jsonl metrics on stdout require --out=file or --metrics-out=file.\n");
+        exit(1);
+    }
+    if (opts.outformat != OUT_TEXT && resultspath.isEmpty() && jobspath.isEmpty())
+    {   // (the console text is written to stdout as well)
+        fprintf(stderr, "The binary and compressed output formats require --out=file.\n");
+        exit(1);
+    }
+
+    if (merge)
+    {
+        QCoreApplication app(argc, argv);
+        return mergeShards(inputs, resultspath);
+    }
+
+    if (convert)
+    {
+        QCoreApplication app(argc, argv);
+        return convertSeedList(inputs, resultspath, sortlist);
+    }
+
+    if (!opts.serve.isEmpty() || !opts.connect.isEmpty())
+    {
+        QCoreApplication app(argc, argv);
+#if WITH_DISTRIBUTED
+        if (!opts.connect.isEmpty())
+        {
+            SearchClient client(opts, &app);
+            QObject::connect(&client, SIGNAL(finished()), &app, SLOT(quit()));
+            QTimer::singleShot(0, &client, SLOT(run()));
+            return app.exec();
+        }
+        SearchServer server(sessionpath, resultspath, opts, &app);
+        QObject::connect(&server, SIGNAL(finished()), &app, SLOT(quit()));
+        QTimer::singleShot(0, &server, SLOT(run()));
+        return app.exec();
+#else
+        fprintf(stderr, "Distributed searches require a build with network support "
+                        "(qmake CONFIG+=with_network).\n");
+        return 1;
+#endif
+    }
+
+    if (!jobspath.isEmpty())
+    {
+        QCoreApplication app(argc, argv);
+        JobQueue queue(opts, resultspath, &app);
+        if (!queue.load(jobspath))
+            return 1;
+
+        QObject::connect(&queue, SIGNAL(finished()), &app, SLOT(quit()));
+        QTimer::singleShot(0, &queue, SLOT(run()));
+
+        return app.exec();
+    }
+
     if (nogui)
     {
         QCoreApplication app(argc, argv);
-        Headless headless(sessionpath, resultspath, &app);
+        Headless headless(sessionpath, resultspath, opts, &app);
 
         QObject::connect(&headless, SIGNAL(finished()), &app, SLOT(quit()));
         QTimer::singleShot(0, &headless, SLOT(run()));
@@ -1199,6 +1199,8 @@ void MainWindow::onUpdateConfig()
 
     g_fontscale = fm_new.height() / (qreal) fm_ref.height();
     g_iconscale = config.iconScale;
+    g_luabudget = config.luaBudget;
+    g_luaprofiling = config.luaProfile;
 
     getMapView()->setConfig(config);
 
@@ -1,6 +1,7 @@
 #include "mapview.h"
 
 #include "gotodialog.h"
+#include "scripts.h"
 #include "util.h"
 
 #include <QAction>
@@ -52,6 +53,8 @@ MapView::MapView(QWidget *parent)
     , updatecounter()
     , lopt()
     , config()
+    , luahash()
+    , luapath()
 {
     memset(sshow, 0, sizeof(sshow));
 
@@ -101,6 +104,8 @@ void MapView::refresh()
         deleteWorld();
         world = new QWorld(wi, dim, lopt);
         QObject::connect(world, &QWorld::update, this, &MapView::mapUpdate);
+        if (luahash)
+            world->setLuaOverlay(luahash, luapath);
     }
 }
 
@@ -197,6 +202,15 @@ void MapView::setShapes(const std::vector<Shape>& s)
     update(1);
 }
 
+void MapView::setLuaOverlay(uint64_t hash, const QString& path)
+{
+    luahash = hash;
+    luapath = path;
+    if (world)
+        world->setLuaOverlay(hash, path);
+    update(2);
+}
+
 void MapView::refreshBiomeColors()
 {
     if (world)
@@ -219,6 +233,8 @@ void MapView::settingsToWorld()
     world->threadlimit = config.mapThreads;
     world->lopt = lopt;
     world->shapes = shapes;
+    if (world->luahash != luahash || world->luapath != luapath)
+        world->setLuaOverlay(luahash, luapath);
 }
 
 static qreal smoothstep(qreal x)
@@ -443,6 +459,21 @@ void MapView::showContextMenu(const QPoint &pos)
     }
     //menu->addAction(tr("Animation"), this, &MapView::runAni);
 
+    QMenu *luamenu = menu->addMenu(tr("Lua overlay"));
+    QAction *luaact = luamenu->addAction(tr("None"), [=](){ this->setLuaOverlay(0, ""); });
+    luaact->setCheckable(true);
+    luaact->setChecked(luahash == 0);
+    QMap<uint64_t, QString> scripts;
+    getScripts(scripts);
+    for (auto it = scripts.begin(); it != scripts.end(); ++it)
+    {
+        uint64_t hash = it.key();
+        QString path = it.value();
+        luaact = luamenu->addAction(QFileInfo(path).fileName(), [=](){ this->setLuaOverlay(hash, path); });
+        luaact->setCheckable(true);
+        luaact->setChecked(hash == luahash);
+    }
+
     for (QAction *act : menu->actions())
         act->setFont(font());
     menu->popup(mapToGlobal(pos));
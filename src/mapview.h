@@ -56,6 +56,8 @@ public:
     void setConfig(const Config& config);
     void setShapes(const std::vector<Shape>& shapes);
     void refreshBiomeColors();
+    // shows the tile() values of a Lua script as an overlay (0 to disable)
+    void setLuaOverlay(uint64_t hash, const QString& path);
 
     void timeout();
 
@@ -117,6 +119,8 @@ private:
     bool sshow[D_STRUCT_NUM];
     LayerOpt lopt;
     Config config;
+    uint64_t luahash;
+    QString luapath;
 };
 
 #endif // MAPVIEW_H
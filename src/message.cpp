@@ -3,6 +3,14 @@
 #include <QApplication>
 #include <QTextStream>
 
+#include <cstdio>
+
+static bool g_term_stderr = false;
+
+void setTermStderr(bool enabled)
+{
+    g_term_stderr = enabled;
+}
 
 static
 int term_prompt(const QString& title, const QString& text, QMessageBox::StandardButtons buttons)
@@ -14,7 +22,7 @@ int term_prompt(const QString& title, const QString& text, QMessageBox::Standard
     QApplication::translate("QGnomeTheme", "&Close");
     QApplication::translate("QGnomeTheme", "Close without Saving");
 
-    QTextStream out (stdout);
+    QTextStream out (g_term_stderr ? stderr : stdout);
     out << QString("[%1]\n%2\n---\n").arg(title).arg(text);
     std::vector<std::pair<QString, int>> opts;
     if (buttons & QMessageBox::Ok)
@@ -8,4 +8,8 @@ void warn(QWidget *parent, const QString& title, const QString& text);
 void warn(QWidget *parent, const QString& text);
 void info(QWidget *parent, const QString& text);
 
+// Sends the messages without a parent (on the terminal) to stderr rather
+// than stdout, when stdout carries the output of the program.
+void setTermStderr(bool enabled);
+
 #endif // MESSAGE_H
@@ -4,16 +4,24 @@
 #include "util.h"
 
 #include <QApplication>
+#include <QDateTime>
 #include <QDebug>
 #include <QDirIterator>
+#include <QFile>
 #include <QFileInfo>
+#include <QFileSystemWatcher>
 #include <QPainter>
 #include <QStandardPaths>
+#include <QThread>
 #include <QTextBlock>
 #include <QTextDocumentFragment>
 
+#include <algorithm>
+#include <functional>
+
 
 LuaOutput g_lua_output[100];
+LuaProfileOutput g_lua_profile[100];
 
 
 static inline uint64_t murmur64(const void *key, int len, uint64_t h = 0)
@@ -66,32 +74,173 @@ uint64_t getScriptHash(QFileInfo finfo)
     return murmur64(fnam.data(), fnam.size() * sizeof(QChar));
 }
 
+/* The scripts in the Lua directory are kept in a process-wide registry.
+ * Once getScripts() has been used from the main thread, a file system
+ * watcher marks the registry for a rescan whenever the directory changes,
+ * so the directory is otherwise only listed once. (Without the watcher,
+ * every call rescans.) The compiled scripts are cached by acquireScript().
+ */
+struct ScriptRegistry
+{
+    QMutex mutex;
+    QMap<uint64_t, QString> scripts;    // script hash => path
+    QMap<QString, uint64_t> hashes;     // path => script hash
+    QFileSystemWatcher *watcher;
+    bool valid;
+
+    ScriptRegistry() : mutex(), scripts(), hashes(), watcher(), valid() {}
+
+    void rescan()
+    {
+        QMap<uint64_t, QString> found;
+        QMap<QString, uint64_t> names;
+        QDirIterator it(getLuaDir(), QDirIterator::NoIteratorFlags);
+        while (it.hasNext())
+        {
+            QFileInfo f = QFileInfo(it.next());
+            if (f.suffix() != "lua")
+                continue;
+            QString path = f.absoluteFilePath();
+            auto hit = hashes.find(path);
+            uint64_t hash = hit != hashes.end() ? hit.value() : getScriptHash(f);
+            if (found.contains(hash))
+                qDebug() << "hash collision on: " << path << " and " << found.value(hash);
+            found.insert(hash, path);
+            names.insert(path, hash);
+        }
+        scripts = found;
+        hashes = names;
+    }
+};
+
+static ScriptRegistry g_registry;
+
+void invalidateScripts()
+{
+    QMutexLocker locker(&g_registry.mutex);
+    g_registry.valid = false;
+}
+
 void getScripts(QMap<uint64_t, QString>& scripts)
 {
-    QString dir = getLuaDir();
-    QDirIterator it(dir, QDirIterator::NoIteratorFlags);
-    while (it.hasNext())
+    QMutexLocker locker(&g_registry.mutex);
+    QCoreApplication *app = QCoreApplication::instance();
+    if (!g_registry.watcher && app && QThread::currentThread() == app->thread())
     {
-        QFileInfo f = QFileInfo(it.next());
-        if (f.suffix() != "lua")
-            continue;
-        uint64_t hash = getScriptHash(f);
-        if (scripts.contains(hash))
-            qDebug() << "hash collision on: " << f.absoluteFilePath() << " and " << scripts.value(hash);
-        scripts.insert(hash, f.absoluteFilePath());
+        g_registry.watcher = new QFileSystemWatcher(app);
+        if (g_registry.watcher->addPath(getLuaDir()))
+        {
+            QObject::connect(g_registry.watcher, &QFileSystemWatcher::directoryChanged,
+                [](const QString&) { invalidateScripts(); });
+            g_registry.valid = false;
+        }
+    }
+    bool watching = g_registry.watcher && !g_registry.watcher->directories().isEmpty();
+    if (!g_registry.valid || !watching)
+    {
+        g_registry.rescan();
+        g_registry.valid = watching;
     }
+    scripts = g_registry.scripts;
 }
 
-static bool validPos(int x, int y, int z)
+QString getScriptPath(uint64_t hash)
 {
-    return abs(x) <= 3e7 && abs(z) <= 3e7 && y >= -64 && y <= 320;
+    QMap<uint64_t, QString> scripts;
+    getScripts(scripts);
+    return scripts.value(hash);
 }
 
-static int l_getBiomeAt(lua_State *L)
+// Registry keys (by address) for the search environment and the argument
+// tables that are reused between check calls.
+static char g_key_env;
+static char g_key_at;
+static char g_key_deps;
+static char g_key_seeds;
+static char g_key_positions;
+static char g_key_meta;
+
+// reasons for aborting a check call from native code
+enum { LUA_ABORT_NONE, LUA_ABORT_BUDGET, LUA_ABORT_STOP };
+
+static void setEnv(lua_State *L, SearchThreadEnv *env)
+{
+    lua_pushlightuserdata(L, env);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &g_key_env);
+}
+
+static SearchThreadEnv *getEnv(lua_State *L)
 {
-    lua_getglobal(L, "_cb_env");
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &g_key_env);
     SearchThreadEnv *env = (SearchThreadEnv*) lua_touserdata(L, -1);
     lua_pop(L, 1);
+    return env;
+}
+
+// pushes the registry table with the given key, creating it when necessary
+static void pushRegTable(lua_State *L, const void *key, int narr, int nrec)
+{
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, key) != LUA_TTABLE)
+    {
+        lua_pop(L, 1);
+        lua_createtable(L, narr, nrec);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, key);
+    }
+}
+
+// pushes the table at index i of the array at idx, creating it when necessary
+static void pushSubTable(lua_State *L, int idx, lua_Integer i, int nrec)
+{
+    if (lua_rawgeti(L, idx, i) != LUA_TTABLE)
+    {
+        lua_pop(L, 1);
+        lua_createtable(L, 0, nrec);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, idx, i);
+    }
+}
+
+// removes the entries after n from the array at idx
+static void trimArray(lua_State *L, int idx, lua_Integer n)
+{
+    for (lua_Integer i = lua_rawlen(L, idx); i > n; i--)
+    {
+        lua_pushnil(L);
+        lua_rawseti(L, idx, i);
+    }
+}
+
+// updates the array of dependency tables {x, z, id, parent} on top of the stack
+static void setDeps(lua_State *L, const LuaNode *nodes, int n)
+{
+    int t = lua_gettop(L);
+    for (int i = 0; i < n; i++)
+    {
+        pushSubTable(L, t, i+1, 4);
+        lua_pushinteger(L, nodes[i].x);
+        lua_setfield(L, -2, "x");
+        lua_pushinteger(L, nodes[i].z);
+        lua_setfield(L, -2, "z");
+        lua_pushinteger(L, nodes[i].id);
+        lua_setfield(L, -2, "id");
+        lua_pushinteger(L, nodes[i].parent);
+        lua_setfield(L, -2, "parent");
+        lua_pop(L, 1);
+    }
+    trimArray(L, t, n);
+}
+
+// (in 64-bit, so the scaled coordinates of a script cannot overflow)
+static bool validPos(int64_t x, int y, int64_t z)
+{
+    return x >= -30000000 && x <= 30000000 && z >= -30000000 && z <= 30000000 &&
+           y >= -64 && y <= 320;
+}
+
+static int l_getBiomeAt(lua_State *L)
+{
+    SearchThreadEnv *env = getEnv(L);
 
     env->init4Dim(0);
 
@@ -115,25 +264,32 @@ static int l_getBiomeAt(lua_State *L)
 
 static int l_getStructures(lua_State *L)
 {
-    lua_getglobal(L, "_cb_env");
-    SearchThreadEnv *env = (SearchThreadEnv*) lua_touserdata(L, -1);
-    lua_pop(L, 1);
+    SearchThreadEnv *env = getEnv(L);
 
     int styp, x0, z0, x1, z1;
-    z1 = (int) lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    x1 = (int) lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    z0 = (int) lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    x0 = (int) lua_tonumber(L, -1);
-    lua_pop(L, 1);
-    styp = (int) lua_tonumber(L, -1);
-    lua_pop(L, 1);
+    styp = (int) lua_tonumber(L, 1);
+    x0 = (int) lua_tonumber(L, 2);
+    z0 = (int) lua_tonumber(L, 3);
+    x1 = (int) lua_tonumber(L, 4);
+    z1 = (int) lua_tonumber(L, 5);
+    lua_Integer limit = luaL_optinteger(L, 6, 0);
 
     if (x0 > x1) std::swap(x0, x1);
     if (z0 > z1) std::swap(z0, z1);
 
+    if (env->l_reach)
+    {   // only scan the area within the declared reach of the script
+        x0 = std::max(x0, env->l_at.x - env->l_reach);
+        z0 = std::max(z0, env->l_at.z - env->l_reach);
+        x1 = std::min(x1, env->l_at.x + env->l_reach);
+        z1 = std::min(z1, env->l_at.z + env->l_reach);
+        if (x0 > x1 || z0 > z1)
+        {
+            lua_createtable(L, 0, 0);
+            return 1;
+        }
+    }
+
     StructureConfig sconf;
     if (!getStructureConfig(styp, env->mc, &sconf) || !validPos(x0, 0, z0) || !validPos(x1, 0, z1))
     {   // bad structure type, mc version or positions
@@ -146,13 +302,6 @@ static int l_getStructures(lua_State *L)
     else if (sconf.properties & STRUCT_END)
         dim = DIM_END;
 
-    env->init4Dim(dim);
-
-    if (styp == End_City)
-    {
-        env->prepareSurfaceNoise(DIM_END);
-    }
-
     // segment area into structure regions
     double blocksPerRegion = sconf.regionSize * 16.0;
     int rx0 = (int) floor(x0 / blocksPerRegion);
@@ -161,11 +310,19 @@ static int l_getStructures(lua_State *L)
     int rz1 = (int) ceil(z1 / blocksPerRegion);
     int i, j;
 
-    // TODO: process abort signals
-    std::vector<Pos> inst;
+    // the instances are added to the result as they are found
+    lua_settop(L, 0);
+    lua_createtable(L, 0, 0);
+    lua_Integer n = 0;
 
     for (j = rz0; j <= rz1; j++)
     {
+        if (env->stop && *env->stop)
+        {
+            if (env->l_cond)
+                env->l_abort = LUA_ABORT_STOP;
+            return luaL_error(L, "search was stopped");
+        }
         for (i = rx0; i <= rx1; i++)
         {   // check the structure generation attempt in region (i, j)
 
@@ -174,125 +331,774 @@ static int l_getStructures(lua_State *L)
                 continue; // this region is not suitable
             if (pos.x < x0 || pos.x > x1 || pos.z < z0 || pos.z > z1)
                 continue; // structure is outside the specified area
-            if (!isViableStructurePos(styp, &env->g, pos.x, pos.z, 0))
+            if (!env->isViableStructure(styp, dim, pos.x, pos.z))
                 continue; // biomes are not viable
-            if (styp == End_City)
-            {   // end cities have a dedicated terrain checker
-                if (!isViableEndCityTerrain(&env->g, &env->sn, pos.x, pos.z))
+            if (styp == End_City || env->mc >= MC_1_18)
+            {   // end cities and some structures in 1.18+ depend on the terrain
+                env->init4Dim(dim);
+                if (!env->isViableTerrain(styp, pos.x, pos.z))
                     continue;
             }
-            else if (env->mc >= MC_1_18)
-            {   // some structures in 1.18+ depend on the terrain
-                if (!isViableStructureTerrain(styp, &env->g, pos.x, pos.z))
-                    continue;
-            }
-            inst.push_back(pos);
+            lua_createtable(L, 0, 2);
+            lua_pushinteger(L, pos.x);
+            lua_setfield(L, -2, "x");
+            lua_pushinteger(L, pos.z);
+            lua_setfield(L, -2, "z");
+            lua_rawseti(L, 1, ++n);
+            if (limit > 0 && n >= limit)
+                return 1;
         }
     }
+    return 1;
+}
+
+// Area buffers are returned to scripts as userdata, that the results are
+// generated into directly. The values are indexed 1..w*h in row-major order
+// (area[j*w + i + 1]), or by relative cell with area(i, j).
+struct LuaArea
+{
+    int x, z, w, h, scale;
+    int isfloat;
+};
+static const char *g_area_meta = "cubiomes.Area";
+#define LUA_AREA_MAX (1 << 24)
+
+static LuaArea *newArea(lua_State *L, int x, int z, int w, int h, int scale, int isfloat, size_t n)
+{
+    size_t elemsiz = isfloat ? sizeof(float) : sizeof(int);
+    LuaArea *a = (LuaArea*) lua_newuserdatauv(L, sizeof(LuaArea) + n * elemsiz, 0);
+    a->x = x;
+    a->z = z;
+    a->w = w;
+    a->h = h;
+    a->scale = scale;
+    a->isfloat = isfloat;
+    luaL_setmetatable(L, g_area_meta);
+    return a;
+}
 
-    lua_createtable(L, inst.size(), 0);
-    for (int i = 0, n = inst.size(); i < n; i++)
+static void pushAreaValue(lua_State *L, const LuaArea *a, lua_Integer i)
+{
+    if (i < 0 || i >= (lua_Integer) a->w * a->h)
+        lua_pushnil(L);
+    else if (a->isfloat)
+        lua_pushnumber(L, ((const float*)(a+1))[i]);
+    else
+        lua_pushinteger(L, ((const int*)(a+1))[i]);
+}
+
+static int l_area_index(lua_State *L)
+{
+    LuaArea *a = (LuaArea*) luaL_checkudata(L, 1, g_area_meta);
+    int isnum;
+    lua_Integer i = lua_tointegerx(L, 2, &isnum);
+    if (isnum)
     {
-        lua_createtable(L, 0, 2);
-        lua_pushinteger(L, inst[i].x);
-        lua_setfield(L, -2, "x");
-        lua_pushinteger(L, inst[i].z);
-        lua_setfield(L, -2, "z");
-        lua_seti(L, -2, i+1);
+        pushAreaValue(L, a, i - 1);
+        return 1;
     }
+    const char *k = lua_tostring(L, 2);
+    if (!k)                     lua_pushnil(L);
+    else if (!strcmp(k, "x"))   lua_pushinteger(L, a->x);
+    else if (!strcmp(k, "z"))   lua_pushinteger(L, a->z);
+    else if (!strcmp(k, "w"))   lua_pushinteger(L, a->w);
+    else if (!strcmp(k, "h"))   lua_pushinteger(L, a->h);
+    else if (!strcmp(k, "scale")) lua_pushinteger(L, a->scale);
+    else                        lua_pushnil(L);
+    return 1;
+}
+
+static int l_area_len(lua_State *L)
+{
+    LuaArea *a = (LuaArea*) luaL_checkudata(L, 1, g_area_meta);
+    lua_pushinteger(L, (lua_Integer) a->w * a->h);
+    return 1;
+}
+
+static int l_area_call(lua_State *L)
+{
+    LuaArea *a = (LuaArea*) luaL_checkudata(L, 1, g_area_meta);
+    lua_Integer i = luaL_checkinteger(L, 2);
+    lua_Integer j = luaL_checkinteger(L, 3);
+    if (i < 0 || i >= a->w || j < 0 || j >= a->h)
+        lua_pushnil(L);
+    else
+        pushAreaValue(L, a, j * a->w + i);
+    return 1;
+}
+
+static void getAreaArgs(lua_State *L, int arg, int *x, int *z, int *w, int *h)
+{
+    *x = (int) luaL_checkinteger(L, arg+0);
+    *z = (int) luaL_checkinteger(L, arg+1);
+    *w = (int) luaL_checkinteger(L, arg+2);
+    *h = (int) luaL_checkinteger(L, arg+3);
+    luaL_argcheck(L, *w > 0 && *h > 0 && (int64_t)*w * *h <= LUA_AREA_MAX, arg+2,
+        "area size is out of range");
+}
+
+static int l_getBiomeArea(lua_State *L)
+{
+    SearchThreadEnv *env = getEnv(L);
+
+    int scale = (int) luaL_checkinteger(L, 1);
+    luaL_argcheck(L, scale == 1 || scale == 4 || scale == 16 || scale == 64 || scale == 256,
+        1, "scale should be one of 1, 4, 16, 64 or 256");
+    int x, z, w, h;
+    getAreaArgs(L, 2, &x, &z, &w, &h);
+    int y = (int) luaL_optinteger(L, 6, 320);
+    if (!validPos((int64_t) x * scale, y, (int64_t) z * scale) ||
+        !validPos(((int64_t) x + w) * scale, y, ((int64_t) z + h) * scale))
+        return 0;
+
+    env->init4Dim(0);
+
+    Range r = {scale, x, z, w, h, scale == 1 ? y : y >> 2, 1};
+    size_t n = getMinCacheSize(&env->g, scale, w, 1, h);
+    LuaArea *a = newArea(L, x, z, w, h, scale, 0, n);
+    if (genBiomes(&env->g, (int*)(a+1), r) != 0)
+        return 0;
     return 1;
 }
 
-lua_State *loadScript(QString path, QString *err)
+static int l_getClimateArea(lua_State *L)
 {
+    SearchThreadEnv *env = getEnv(L);
+
+    int para = (int) luaL_checkinteger(L, 1);
+    luaL_argcheck(L, para >= 0 && para < NP_MAX && para != NP_DEPTH, 1, "invalid climate parameter");
+    int x, z, w, h;
+    getAreaArgs(L, 2, &x, &z, &w, &h);
+    if (env->mc <= MC_1_17)
+        return 0;
+    if (!validPos((int64_t) x * 4, 0, (int64_t) z * 4) ||
+        !validPos(((int64_t) x + w) * 4, 0, ((int64_t) z + h) * 4))
+        return 0;
+
+    env->init4Noise(para, 0);
+
+    LuaArea *a = newArea(L, x, z, w, h, 4, 1, (size_t) w * h);
+    float *buf = (float*)(a+1);
+    const DoublePerlinNoise *dpn = &env->g.bn.climate[para];
+    for (int j = 0; j < h; j++)
+    {
+        for (int i = 0; i < w; i++)
+            buf[j*w+i] = (float) (10000 * sampleDoublePerlin(dpn, x+i, 0, z+j));
+    }
+    return 1;
+}
+
+static int l_getHeightArea(lua_State *L)
+{
+    SearchThreadEnv *env = getEnv(L);
+
+    int x, z, w, h;
+    getAreaArgs(L, 1, &x, &z, &w, &h);
+    if (env->mc <= MC_1_17)
+        return 0;
+    if (!validPos((int64_t) x * 4, 0, (int64_t) z * 4) ||
+        !validPos(((int64_t) x + w) * 4, 0, ((int64_t) z + h) * 4))
+        return 0;
+
+    env->init4Dim(DIM_OVERWORLD);
+    env->prepareSurfaceNoise(DIM_OVERWORLD);
+
+    LuaArea *a = newArea(L, x, z, w, h, 4, 1, (size_t) w * h);
+    if (mapApproxHeight((float*)(a+1), nullptr, &env->g, &env->sn, x, z, w, h) != 0)
+        return 0;
+    return 1;
+}
+
+static int l_setSeed(lua_State *L)
+{
+    SearchThreadEnv *env = getEnv(L);
+    if (!env->l_batchrun)
+        return luaL_error(L, "setSeed() can only be used within check_batch()");
+    env->setSeed((uint64_t) luaL_checkinteger(L, 1));
+    return 0;
+}
+
+struct LuaGlobal
+{
+    const char *name;
+    lua_Integer value;
+};
+
+// the predefined integer globals (biome IDs and structure types), gathered once
+static const std::vector<LuaGlobal>& getLuaGlobals()
+{
+    static const std::vector<LuaGlobal> globals = []() {
+        std::vector<LuaGlobal> v;
+        for (int id = 0; id < 256; id++)
+        {
+            const char *bname = biome2str(MC_NEWEST, id);
+            if (bname)
+            {
+                v.push_back(LuaGlobal{bname, id});
+                const char *bname_old = biome2str(MC_1_13, id);
+                if (bname != bname_old)
+                    v.push_back(LuaGlobal{bname, id});
+            }
+        }
+        LuaGlobal values[] = {
+            {"Desert_Pyramid", Desert_Pyramid},
+            {"Jungle_Temple", Jungle_Temple},
+            {"Swamp_Hut", Swamp_Hut},
+            {"Igloo", Igloo},
+            {"Village", Village},
+            {"Ocean_Ruin", Ocean_Ruin},
+            {"Shipwreck", Shipwreck},
+            {"Monument", Monument},
+            {"Mansion", Mansion},
+            {"Outpost", Outpost},
+            {"Ruined_Portal", Ruined_Portal},
+            {"Ruined_Portal_N", Ruined_Portal_N},
+            {"Treasure", Treasure},
+            {"Mineshaft", Mineshaft},
+            {"Fortress", Fortress},
+            {"Bastion", Bastion},
+            {"End_City", End_City},
+            {"End_Gateway", End_Gateway},
+            {"Ancient_City", Ancient_City},
+        };
+        for (size_t i = 0; i < sizeof(values)/sizeof(values[0]); i++)
+            v.push_back(values[i]);
+        return v;
+    }();
+    return globals;
+}
+
+static int l_writeChunk(lua_State *, const void *p, size_t sz, void *ud)
+{
+    ((QByteArray*) ud)->append((const char*) p, sz);
+    return 0;
+}
+
+// compiles a script file to bytecode, with a hash of its source as version
+static bool compileScript(const QString& path, QByteArray *bytecode, uint64_t *version, QString *err)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        if (err) *err = QApplication::translate("Filter", "failed to open script: %1").arg(path);
+        return false;
+    }
+    QByteArray src = file.readAll();
+    *version = murmur64(src.data(), src.size());
+    if (src.startsWith('#'))
+    {   // skip a shebang line, as luaL_loadfile would (keeping line numbers)
+        int n = src.indexOf('\n');
+        src.remove(0, n < 0 ? src.size() : n);
+    }
+
     lua_State *L = luaL_newstate();
+    QByteArray chunkname = ("@" + path).toLocal8Bit();
+    bool ok = luaL_loadbufferx(L, src.data(), src.size(), chunkname.data(), "t") == LUA_OK;
+    if (ok)
+    {
+        bytecode->clear();
+        lua_dump(L, l_writeChunk, bytecode, 0);
+    }
+    else if (err)
+    {
+        *err = lua_tostring(L, -1);
+    }
+    lua_close(L);
+    return ok;
+}
+
+/* Search-time states are created with their own allocator, so that the Lua
+ * allocations of the workers do not contend on the global heap. Each state
+ * is only used by one thread at a time. Small blocks are served from size
+ * class free lists, carved from chunks that are released together with the
+ * state. Larger blocks go to the system allocator.
+ */
+struct LuaArena
+{
+    enum { CLASS_SHIFT = 4, CLASS_NUM = 32, CHUNK_SIZE = 64 * 1024 };
+    enum { SMALL_MAX = CLASS_NUM << CLASS_SHIFT };
+
+    void *freelist[CLASS_NUM];
+    std::vector<void*> chunks;
+    char *cur;
+    size_t left;
+    LuaAllocStats stats;
+
+    LuaArena() : freelist(), chunks(), cur(), left(), stats() {}
+    ~LuaArena()
+    {
+        for (void *p : chunks)
+            free(p);
+    }
+
+    static int sizeClass(size_t n) { return (int)((n - 1) >> CLASS_SHIFT); }
+
+    void *allocSmall(size_t n)
+    {
+        int c = sizeClass(n);
+        void *p = freelist[c];
+        if (p)
+        {
+            freelist[c] = *(void**) p;
+            stats.pooled++;
+            return p;
+        }
+        size_t bsiz = (size_t)(c + 1) << CLASS_SHIFT;
+        if (left < bsiz)
+        {
+            cur = (char*) malloc(CHUNK_SIZE);
+            if (!cur)
+            {
+                left = 0;
+                return nullptr;
+            }
+            chunks.push_back(cur);
+            left = CHUNK_SIZE;
+            stats.reserved += CHUNK_SIZE;
+        }
+        p = cur;
+        cur += bsiz;
+        left -= bsiz;
+        return p;
+    }
+
+    void freeSmall(void *p, size_t n)
+    {
+        int c = sizeClass(n);
+        *(void**) p = freelist[c];
+        freelist[c] = p;
+    }
+
+    void *alloc(void *ptr, size_t osize, size_t nsize)
+    {
+        if (!ptr)
+            osize = 0; // osize encodes the object type
+        void *p = nullptr;
+        if (nsize == 0)
+        {
+            if (osize > SMALL_MAX)
+                free(ptr);
+            else if (ptr)
+                freeSmall(ptr, osize);
+        }
+        else if (osize > SMALL_MAX && nsize > SMALL_MAX)
+        {
+            p = realloc(ptr, nsize);
+            if (!p) return nullptr;
+        }
+        else if (osize && sizeClass(osize) == sizeClass(nsize) && nsize <= SMALL_MAX)
+        {
+            p = ptr;
+        }
+        else
+        {
+            p = nsize > SMALL_MAX ? malloc(nsize) : allocSmall(nsize);
+            if (!p) return nullptr;
+            if (ptr)
+            {
+                memcpy(p, ptr, osize < nsize ? osize : nsize);
+                if (osize > SMALL_MAX)
+                    free(ptr);
+                else
+                    freeSmall(ptr, osize);
+            }
+        }
+        if (nsize > osize)
+            stats.allocs++;
+        stats.bytes += nsize;
+        stats.bytes -= osize;
+        if (stats.bytes > stats.peak)
+            stats.peak = stats.bytes;
+        return p;
+    }
+};
+
+static void *l_arenaAlloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    return ((LuaArena*) ud)->alloc(ptr, osize, nsize);
+}
+
+static int l_panic(lua_State *L)
+{
+    const char *msg = lua_tostring(L, -1);
+    qCritical() << "Lua panic:" << (msg ? msg : "error object is not a string");
+    return 0;
+}
+
+static lua_State *newArenaState()
+{
+    LuaArena *arena = new LuaArena();
+    lua_State *L = lua_newstate(l_arenaAlloc, arena);
+    if (!L)
+    {
+        delete arena;
+        return nullptr;
+    }
+    lua_atpanic(L, l_panic);
+    return L;
+}
+
+static void closeArenaState(lua_State *L)
+{
+    void *ud = nullptr;
+    lua_Alloc f = lua_getallocf(L, &ud);
+    lua_close(L);
+    if (f == l_arenaAlloc)
+        delete (LuaArena*) ud;
+}
+
+bool getScriptAllocStats(lua_State *L, LuaAllocStats *stats)
+{
+    void *ud = nullptr;
+    if (lua_getallocf(L, &ud) != l_arenaAlloc)
+        return false;
+    *stats = ((LuaArena*) ud)->stats;
+    return true;
+}
+
+static void resetScriptAllocStats(lua_State *L)
+{
+    void *ud = nullptr;
+    if (lua_getallocf(L, &ud) != l_arenaAlloc)
+        return;
+    LuaAllocStats& s = ((LuaArena*) ud)->stats;
+    s.allocs = s.pooled = 0;
+    s.peak = s.bytes;
+}
+
+// reads the meta table of a script that has been run
+static bool parseMeta(lua_State *L, LuaMeta *meta, QString *err)
+{
+    *meta = LuaMeta();
+    int type = lua_getglobal(L, "meta");
+    if (type == LUA_TNIL)
+    {
+        lua_pop(L, 1);
+        return true;
+    }
+    if (type != LUA_TTABLE)
+    {
+        if (err) *err = QApplication::translate("Filter", "meta has to be a table");
+        lua_pop(L, 1);
+        return false;
+    }
     bool ok = false;
     do
     {
-        if (luaL_loadfile(L, path.toLocal8Bit().data()) != LUA_OK)
+        type = lua_getfield(L, -1, "dep64");
+        if (type == LUA_TBOOLEAN)
+            meta->dep64 = lua_toboolean(L, -1);
+        else if (type != LUA_TNIL)
         {
-            if (err) *err = lua_tostring(L, -1);
+            if (err) *err = QApplication::translate("Filter", "meta.dep64 has to be a boolean");
             break;
         }
-        luaL_openlibs(L);
-        if (lua_pcall(L, 0, LUA_MULTRET, 0) != LUA_OK)
+        lua_pop(L, 1);
+
+        type = lua_getfield(L, -1, "reach");
+        if (type == LUA_TNUMBER)
         {
-            if (err) *err = lua_tostring(L, -1);
-            break;
+            lua_Number r = lua_tonumber(L, -1);
+            if (!(r >= 0 && r <= 30e6))
+            {
+                if (err) *err = QApplication::translate("Filter", "meta.reach is out of range");
+                break;
+            }
+            meta->reach = (int) ceil(r);
         }
-        if (lua_getglobal(L, "check") != LUA_TFUNCTION)
+        else if (type != LUA_TNIL)
         {
-            if (err) *err = QApplication::translate("Filter", "function check() was not defined");
+            if (err) *err = QApplication::translate("Filter", "meta.reach has to be a number");
             break;
         }
         lua_pop(L, 1);
-        for (int id = 0; id < 256; id++)
+
+        type = lua_getfield(L, -1, "cost");
+        if (type == LUA_TSTRING)
         {
-            const char *bname = biome2str(MC_NEWEST, id);
-            if (bname)
+            QString cost = lua_tostring(L, -1);
+            if (cost == "low")
+                meta->cost = LuaMeta::COST_LOW;
+            else if (cost == "medium")
+                meta->cost = LuaMeta::COST_MEDIUM;
+            else if (cost == "high")
+                meta->cost = LuaMeta::COST_HIGH;
+            else
             {
-                lua_pushinteger(L, id);
-                lua_setglobal(L, bname);
-                const char *bname_old = biome2str(MC_1_13, id);
-                if (bname != bname_old)
-                {
-                    lua_pushinteger(L, id);
-                    lua_setglobal(L, bname);
-                }
+                if (err) *err = QApplication::translate("Filter", "meta.cost has to be \"low\", \"medium\" or \"high\"");
+                break;
             }
         }
-        struct { int value; const char *name; } values[] = {
-            {Desert_Pyramid, "Desert_Pyramid"},
-            {Jungle_Temple, "Jungle_Temple"},
-            {Swamp_Hut, "Swamp_Hut"},
-            {Igloo, "Igloo"},
-            {Village, "Village"},
-            {Ocean_Ruin, "Ocean_Ruin"},
-            {Shipwreck, "Shipwreck"},
-            {Monument, "Monument"},
-            {Mansion, "Mansion"},
-            {Outpost, "Outpost"},
-            {Ruined_Portal, "Ruined_Portal"},
-            {Ruined_Portal_N, "Ruined_Portal_N"},
-            {Treasure, "Treasure"},
-            {Mineshaft, "Mineshaft"},
-            {Fortress, "Fortress"},
-            {Bastion, "Bastion"},
-            {End_City, "End_City"},
-            {End_Gateway, "End_Gateway"},
-            {Ancient_City, "Ancient_City"},
-        };
-        for (size_t i = 0; i < sizeof(values)/sizeof(values[0]); i++)
+        else if (type != LUA_TNIL)
         {
-            lua_pushinteger(L, values[i].value);
-            lua_setglobal(L, values[i].name);
+            if (err) *err = QApplication::translate("Filter", "meta.cost has to be a string");
+            break;
+        }
+        ok = true;
+    }
+    while (0);
+    lua_settop(L, 0);
+    return ok;
+}
+
+LuaMeta getScriptMeta(lua_State *L)
+{
+    LuaMeta meta;
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &g_key_meta) == LUA_TUSERDATA)
+        meta = *(const LuaMeta*) lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return meta;
+}
+
+// creates a state that has run the compiled script and defines the globals
+static lua_State *newScriptState(const QByteArray& bytecode, const QString& path, QString *err)
+{
+    lua_State *L = newArenaState();
+    if (!L)
+        return nullptr;
+    bool ok = false;
+    do
+    {
+        QByteArray chunkname = ("@" + path).toLocal8Bit();
+        if (luaL_loadbufferx(L, bytecode.data(), bytecode.size(), chunkname.data(), "b") != LUA_OK)
+        {
+            if (err) *err = lua_tostring(L, -1);
+            break;
+        }
+        luaL_openlibs(L);
+        if (lua_pcall(L, 0, LUA_MULTRET, 0) != LUA_OK)
+        {
+            if (err) *err = lua_tostring(L, -1);
+            break;
+        }
+        if (lua_getglobal(L, "check") != LUA_TFUNCTION &&
+            lua_getglobal(L, "tile") != LUA_TFUNCTION)
+        {   // the script has to be either a condition or a map overlay
+            if (err) *err = QApplication::translate("Filter", "function check() was not defined");
+            break;
+        }
+        lua_settop(L, 0);
+        LuaMeta meta;
+        if (!parseMeta(L, &meta, err))
+            break;
+        *(LuaMeta*) lua_newuserdatauv(L, sizeof(LuaMeta), 0) = meta;
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &g_key_meta);
+        for (const LuaGlobal& g : getLuaGlobals())
+        {
+            lua_pushinteger(L, g.value);
+            lua_setglobal(L, g.name);
         }
         lua_pushcfunction(L, l_getBiomeAt);
         lua_setglobal(L, "getBiomeAt");
         lua_pushcfunction(L, l_getStructures);
         lua_setglobal(L, "getStructures");
+        lua_pushcfunction(L, l_setSeed);
+        lua_setglobal(L, "setSeed");
+        lua_pushcfunction(L, l_getBiomeArea);
+        lua_setglobal(L, "getBiomeArea");
+        lua_pushcfunction(L, l_getClimateArea);
+        lua_setglobal(L, "getClimateArea");
+        lua_pushcfunction(L, l_getHeightArea);
+        lua_setglobal(L, "getHeightArea");
+        if (luaL_newmetatable(L, g_area_meta))
+        {
+            lua_pushcfunction(L, l_area_index);
+            lua_setfield(L, -2, "__index");
+            lua_pushcfunction(L, l_area_len);
+            lua_setfield(L, -2, "__len");
+            lua_pushcfunction(L, l_area_call);
+            lua_setfield(L, -2, "__call");
+        }
+        lua_pop(L, 1);
         ok = true;
     }
     while (0);
 
     if (!ok)
     {
-        lua_close(L);
+        closeArenaState(L);
         return nullptr;
     }
     return L;
 }
 
-struct node_t
+struct ScriptPool
 {
-    int x, z, id, parent;
+    QString path;
+    QDateTime mtime;
+    qint64 size;
+    uint64_t version;                   // source hash of the compiled script
+    QByteArray bytecode;
+    std::vector<lua_State*> idle;       // initialized states ready for reuse
 };
-static void gather_nodes(std::vector<node_t>& nodes, const ConditionTree *tree, const Pos *path, int id)
+
+static QMutex g_pool_mutex;
+static std::map<uint64_t, ScriptPool> g_pools;
+// states in use => (script hash, version)
+static std::map<lua_State*, std::pair<uint64_t, uint64_t>> g_pool_busy;
+
+lua_State *acquireScript(uint64_t hash, const QString& path, QString *err)
+{
+    QFileInfo finfo(path);
+    QMutexLocker locker(&g_pool_mutex);
+    ScriptPool& pool = g_pools[hash];
+
+    if (pool.bytecode.isEmpty() || pool.path != path ||
+        pool.mtime != finfo.lastModified() || pool.size != finfo.size())
+    {
+        QByteArray bytecode;
+        uint64_t version;
+        if (!compileScript(path, &bytecode, &version, err))
+            return nullptr;
+        if (pool.bytecode.isEmpty() || version != pool.version)
+        {   // retire the states of the previous version
+            for (lua_State *L : pool.idle)
+                closeArenaState(L);
+            pool.idle.clear();
+            pool.bytecode = bytecode;
+            pool.version = version;
+        }
+        pool.path = path;
+        pool.mtime = finfo.lastModified();
+        pool.size = finfo.size();
+    }
+
+    lua_State *L = nullptr;
+    uint64_t version = pool.version;
+    if (!pool.idle.empty())
+    {
+        L = pool.idle.back();
+        pool.idle.pop_back();
+    }
+    else
+    {   // initialize a new state outside of the lock
+        QByteArray bytecode = pool.bytecode;
+        locker.unlock();
+        L = newScriptState(bytecode, path, err);
+        if (!L)
+            return nullptr;
+        locker.relock();
+    }
+    g_pool_busy[L] = std::make_pair(hash, version);
+    resetScriptAllocStats(L);
+    return L;
+}
+
+void releaseScript(lua_State *L)
+{
+    QMutexLocker locker(&g_pool_mutex);
+    auto it = g_pool_busy.find(L);
+    if (it != g_pool_busy.end())
+    {
+        uint64_t hash = it->second.first;
+        uint64_t version = it->second.second;
+        g_pool_busy.erase(it);
+        auto pit = g_pools.find(hash);
+        if (pit != g_pools.end() && pit->second.version == version)
+        {
+            lua_settop(L, 0);
+            pit->second.idle.push_back(L);
+            return;
+        }
+    }
+    closeArenaState(L);
+}
+
+static void l_hook(lua_State *L, lua_Debug *ar)
+{
+    (void) ar;
+    SearchThreadEnv *env = getEnv(L);
+    if (!env || !env->l_cond)
+        return; // not within a check call
+    env->l_count += LUA_HOOK_STEP;
+    if (env->stop && *env->stop)
+    {
+        env->l_abort = LUA_ABORT_STOP;
+        luaL_error(L, "search was stopped");
+    }
+    if (env->l_limit && env->l_count > env->l_limit)
+    {
+        env->l_abort = LUA_ABORT_BUDGET;
+        luaL_error(L, "instruction budget exceeded (%I)", (lua_Integer) env->l_limit);
+    }
+    if (env->l_profile)
+    {   // sample the innermost script line
+        lua_Debug d;
+        for (int level = 0; lua_getstack(L, level, &d); level++)
+        {
+            lua_getinfo(L, "l", &d);
+            if (d.currentline > 0)
+            {
+                env->l_prof[env->l_cond->save].lines[d.currentline]++;
+                break;
+            }
+        }
+    }
+}
+
+void setScriptHook(lua_State *L)
+{
+    lua_sethook(L, l_hook, LUA_MASKCOUNT, LUA_HOOK_STEP);
+}
+
+// calls the function on the stack with the hook limits of a check
+static int callCheck(lua_State *L, SearchThreadEnv *env, const Condition *cond,
+    int nargs, int nres, int64_t ncalls)
+{
+    env->l_cond = cond;
+    env->l_count = 0;
+    env->l_limit = env->l_budget * ncalls;
+    env->l_abort = LUA_ABORT_NONE;
+    int status = lua_pcall(L, nargs, nres, 0);
+    if (env->l_profile)
+    {
+        LuaProfile& p = env->l_prof[cond->save];
+        p.calls += ncalls;
+        p.instructions += env->l_count;
+        if (env->l_abort == LUA_ABORT_BUDGET)
+            p.overruns++;
+    }
+    env->l_cond = nullptr;
+    return status;
+}
+
+QString formatLuaProfile(const LuaProfile& p, int maxlines)
+{
+    QString s = QString::asprintf("calls: %" PRIu64 ", instructions: ~%" PRIu64,
+        p.calls, p.instructions);
+    if (p.calls)
+        s += QString::asprintf(" (~%" PRIu64 " per call)", p.instructions / p.calls);
+    if (p.overruns)
+        s += QString::asprintf(", budget overruns: %" PRIu64, p.overruns);
+    if (p.allocs)
+    {
+        s += QString::asprintf("\nallocations: %" PRIu64 " (%.1f%% pooled), peak memory: %" PRIu64 " KiB",
+            p.allocs, 100.0 * p.pooled / p.allocs, p.peakmem >> 10);
+    }
+
+    std::vector<std::pair<uint64_t, int>> hot;
+    uint64_t total = 0;
+    for (const auto& it : p.lines)
+    {
+        hot.push_back(std::make_pair(it.second, it.first));
+        total += it.second;
+    }
+    std::sort(hot.begin(), hot.end(), std::greater<std::pair<uint64_t, int>>());
+    if (total && maxlines > 0)
+    {
+        s += "\nhot lines:";
+        for (int i = 0, n = hot.size(); i < n && i < maxlines; i++)
+            s += QString::asprintf(" %d (%.1f%%)", hot[i].second, 100.0 * hot[i].first / total);
+    }
+    return s;
+}
+
+static void gather_nodes(std::vector<LuaNode>& nodes, const ConditionTree *tree, const Pos *path, int id)
 {
     const std::vector<char>& branches = tree->references[id];
     for (int b : branches)
     {
-        node_t n = { path[b].x, path[b].z, b, id };
+        LuaNode n = { path[b].x, path[b].z, b, id };
         nodes.push_back(n);
         gather_nodes(nodes, tree, path, b);
     }
@@ -300,7 +1106,6 @@ static void gather_nodes(std::vector<node_t>& nodes, const ConditionTree *tree,
 
 static QMutex g_mutex;
 
-// TODO: honor abort signals
 int runCheckScript(
     lua_State         * L,
     Pos                 at,
@@ -325,73 +1130,281 @@ int runCheckScript(
         return COND_FAILED;
     }
 
-    std::vector<node_t> nodes;
+    thread_local std::vector<LuaNode> nodes;
+    nodes.clear();
     gather_nodes(nodes, &env->condtree, path, cond->save);
 
-    lua_pushlightuserdata(L, env);
-    lua_setglobal(L, "_cb_env");
+    const LuaMeta& meta = env->l_meta[cond->hash];
+    bool cache = (meta.dep64 == 0 && pass != PASS_FAST_48);
+    uint64_t key = 0;
+    if (cache)
+    {   // the result only depends on the 48-bit seed base
+        key = murmur64(&at, sizeof(at), cond->save);
+        key = murmur64(nodes.data(), nodes.size() * sizeof(LuaNode), key);
+        auto it = env->l_cache48.find(key);
+        if (it != env->l_cache48.end())
+        {
+            lua_settop(L, top);
+            if (it->second.st == COND_OK)
+                path[cond->save] = it->second.pos;
+            return it->second.st;
+        }
+    }
+
+    setEnv(L, env);
+    env->l_reach = meta.reach;
+    env->l_at = at;
 
     lua_pushinteger(L, (lua_Integer) env->seed);
 
     // at
-    lua_createtable(L, 0, 2);
+    pushRegTable(L, &g_key_at, 0, 2);
     lua_pushinteger(L, (lua_Integer) at.x);
     lua_setfield(L, -2, "x");
     lua_pushinteger(L, (lua_Integer) at.z);
     lua_setfield(L, -2, "z");
 
-    // create an array for the subtree positions
-    lua_createtable(L, nodes.size(), 0);
-
-    for (int i = 0, n = nodes.size(); i < n; i++)
-    {
-        const node_t& node = nodes[i];
-        lua_createtable(L, 0, 2);
-        lua_pushinteger(L, node.x);
-        lua_setfield(L, -2, "x");
-        lua_pushinteger(L, node.z);
-        lua_setfield(L, -2, "z");
-        lua_pushinteger(L, node.id);
-        lua_setfield(L, -2, "id");
-        lua_pushinteger(L, node.parent);
-        lua_setfield(L, -2, "parent");
-
-        lua_seti(L, -2, i+1);
-    }
+    // update the array for the subtree positions
+    pushRegTable(L, &g_key_deps, nodes.size(), 0);
+    setDeps(L, nodes.data(), nodes.size());
 
     // call: pos = check(seed, area{x1,z1,x2,z2}, branches[b..]{x,z})
-    if (lua_pcallk(L, 3, LUA_MULTRET, 0, 0, NULL) != 0)
+    int status = callCheck(L, env, cond, 3, LUA_MULTRET, 1);
+    env->l_reach = 0;
+    if (status != LUA_OK)
     {
-        QString err = lua_tostring(L, -1);
-        //qDebug() << err;
-        g_lua_output[cond->save].set(cond->hash, env->seed, func, at, err);
+        if (env->l_abort != LUA_ABORT_STOP)
+        {
+            QString err = lua_tostring(L, -1);
+            //qDebug() << err;
+            g_lua_output[cond->save].set(cond->hash, env->seed, func, at, err);
+        }
         lua_settop(L, top);
         return COND_FAILED;
     }
-    if (lua_isnumber(L, -1))
+    int st = COND_FAILED;
+    if (lua_gettop(L) >= top + 2 && lua_isnumber(L, -1) && lua_isnumber(L, -2))
     {
         float z = lua_tonumber(L, -1); // accept floats
-        lua_pop(L, 1);
+        float x = lua_tonumber(L, -2);
+        QString err;
+        if (x != x || z != z || fabs(x) > 30e6 || fabs(z) > 30e6)
+            err = QString::asprintf("Output is invalid or out of range: {%g, %g}", x, z);
+        else if (meta.reach && (fabs(x - at.x) > meta.reach || fabs(z - at.z) > meta.reach))
+            err = QString::asprintf("Output is outside of the declared reach: {%g, %g}", x, z);
+        if (!err.isEmpty())
+        {
+            g_lua_output[cond->save].set(cond->hash, env->seed, func, at, err);
+        }
+        else
+        {
+            path[cond->save].x = (int) x;
+            path[cond->save].z = (int) z;
+            st = (pass == PASS_FAST_48) ? COND_MAYBE_POS_VALID : COND_OK;
+        }
+    }
+    lua_settop(L, top);
+    if (cache)
+    {
+        LuaCached cached = { st, path[cond->save] };
+        env->l_cache48[key] = cached;
+    }
+    return st;
+}
+
+bool hasCheckBatch(lua_State *L)
+{
+    return hasScriptFunction(L, "check_batch");
+}
+
+bool hasScriptFunction(lua_State *L, const char *name)
+{
+    int type = lua_getglobal(L, name);
+    lua_pop(L, 1);
+    return type == LUA_TFUNCTION;
+}
+
+bool runTileScript(uint64_t hash, const QString& path, int mc, bool large, uint64_t seed,
+        Range r, std::atomic_bool *stop, float *values, float *vmin, float *vmax, QString *err)
+{
+    lua_State *L = acquireScript(hash, path, err);
+    if (!L)
+        return false;
+    setScriptHook(L);
+
+    int n = r.sx * r.sz;
+    bool ok = false;
+    do
+    {
+        if (lua_getglobal(L, "tile") != LUA_TFUNCTION)
+        {
+            if (err) *err = QApplication::translate("Filter", "function tile() was not defined");
+            break;
+        }
+
+        // the world queries use an environment without conditions
+        thread_local SearchThreadEnv env;
+        env.init(mc, large, ConditionTree());
+        env.stop = stop;
+        env.l_profile = false;
+        env.setSeed(seed);
+        setEnv(L, &env);
+
+        Condition cond;
+        memset(&cond, 0, sizeof(cond));
+
+        lua_pushinteger(L, (lua_Integer) seed);
+        lua_pushinteger(L, r.x);
+        lua_pushinteger(L, r.z);
+        lua_pushinteger(L, r.sx);
+        lua_pushinteger(L, r.sz);
+        lua_pushinteger(L, r.scale);
+        // call: values, min, max = tile(seed, x, z, w, h, scale)
+        int status = callCheck(L, &env, &cond, 6, 3, n);
+        setEnv(L, nullptr);
+        if (status != LUA_OK)
+        {
+            if (err) *err = lua_tostring(L, -1);
+            break;
+        }
+
+        if (const LuaArea *a = (const LuaArea*) luaL_testudata(L, -3, g_area_meta))
+        {
+            if ((int64_t) a->w * a->h != n)
+            {
+                if (err) *err = QString::asprintf("tile() returned an area of %dx%d for a tile of %dx%d",
+                    a->w, a->h, r.sx, r.sz);
+                break;
+            }
+            for (int i = 0; i < n; i++)
+                values[i] = a->isfloat ? ((const float*)(a+1))[i] : ((const int*)(a+1))[i];
+        }
+        else if (lua_istable(L, -3))
+        {
+            for (int i = 0; i < n; i++)
+            {
+                lua_rawgeti(L, -3, i+1);
+                values[i] = lua_isnumber(L, -1) ? (float) lua_tonumber(L, -1) : NAN;
+                lua_pop(L, 1);
+            }
+        }
+        else
+        {
+            if (err) *err = QApplication::translate("Filter", "tile() has to return a list of values");
+            break;
+        }
+        if (lua_isnumber(L, -2))
+            *vmin = lua_tonumber(L, -2);
         if (lua_isnumber(L, -1))
+            *vmax = lua_tonumber(L, -1);
+        ok = true;
+    }
+    while (0);
+
+    lua_settop(L, 0);
+    releaseScript(L);
+    return ok;
+}
+
+void queueCheckBatch(LuaBatch& batch, Pos at, SearchThreadEnv *env, const Pos *path)
+{
+    LuaQuery q;
+    q.seed = env->seed;
+    q.at = at;
+    q.nodeidx = batch.nodes.size();
+    gather_nodes(batch.nodes, &env->condtree, path, batch.cond->save);
+    q.nodecnt = batch.nodes.size() - q.nodeidx;
+    batch.queries.push_back(q);
+}
+
+void dropCheckBatch(LuaBatch& batch, uint64_t seed)
+{
+    while (!batch.queries.empty() && batch.queries.back().seed == seed)
+    {
+        batch.nodes.resize(batch.queries.back().nodeidx);
+        batch.queries.pop_back();
+    }
+}
+
+void runCheckBatch(LuaBatch& batch, SearchThreadEnv *env, char *ok)
+{
+    lua_State *L = batch.L;
+    const Condition *cond = batch.cond;
+    int top = lua_gettop(L);
+    int n = batch.queries.size();
+
+    do
+    {
+        if (lua_getglobal(L, "check_batch") != LUA_TFUNCTION)
         {
-            float x = lua_tonumber(L, -1);
-            lua_pop(L, 1);
-            lua_settop(L, top);
-            if (x != x || z != z || fabs(x) > 30e6 || fabs(z) > 30e6)
+            memset(ok, 0, n);
+            break;
+        }
+
+        setEnv(L, env);
+
+        pushRegTable(L, &g_key_seeds, n, 0);
+        int t = lua_gettop(L);
+        for (int i = 0; i < n; i++)
+        {
+            lua_pushinteger(L, (lua_Integer) batch.queries[i].seed);
+            lua_rawseti(L, t, i+1);
+        }
+        trimArray(L, t, n);
+
+        pushRegTable(L, &g_key_positions, n, 0);
+        t = lua_gettop(L);
+        for (int i = 0; i < n; i++)
+        {
+            const LuaQuery& q = batch.queries[i];
+            pushSubTable(L, t, i+1, 3);
+            lua_pushinteger(L, q.at.x);
+            lua_setfield(L, -2, "x");
+            lua_pushinteger(L, q.at.z);
+            lua_setfield(L, -2, "z");
+            if (lua_getfield(L, -1, "deps") != LUA_TTABLE)
             {
-                QString err = QString::asprintf("Output is invalid or out of range: {%g, %g}", x, z);
-                g_lua_output[cond->save].set(cond->hash, env->seed, func, at, err);
-                return COND_FAILED;
+                lua_pop(L, 1);
+                lua_createtable(L, q.nodecnt, 0);
+                lua_pushvalue(L, -1);
+                lua_setfield(L, -3, "deps");
             }
-            path[cond->save].x = (int) x;
-            path[cond->save].z = (int) z;
-            if (pass == PASS_FAST_48)
-                return COND_MAYBE_POS_VALID;
-            return COND_OK;
+            setDeps(L, batch.nodes.data() + q.nodeidx, q.nodecnt);
+            lua_pop(L, 2);
+        }
+
+        // call: results = check_batch(seeds[..], positions[..]{x,z,deps})
+        env->l_batchrun = true;
+        int status = callCheck(L, env, cond, 2, 1, n);
+        env->l_batchrun = false;
+        if (status != LUA_OK)
+        {
+            if (env->l_abort != LUA_ABORT_STOP)
+            {
+                QString err = lua_tostring(L, -1);
+                g_lua_output[cond->save].set(cond->hash, env->seed, "check_batch", Pos{0,0}, err);
+            }
+            memset(ok, 0, n);
+            break;
+        }
+        if (!lua_istable(L, -1))
+        {
+            memset(ok, 0, n);
+            break;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            lua_rawgeti(L, -1, i+1);
+            if (!lua_toboolean(L, -1))
+                ok[i] = 0;
+            lua_pop(L, 1);
         }
     }
+    while (0);
+
     lua_settop(L, top);
-    return COND_FAILED;
+    batch.queries.clear();
+    batch.nodes.clear();
 }
 
 
@@ -413,7 +1426,13 @@ LuaHighlighter::LuaHighlighter(QTextDocument *parent)
     format.setForeground(QColor(0, 168, 255));
     rules.append(Rule("\\b" "check" "\\b", format));
     rules.append(Rule("\\b" "check48" "\\b", format));
+    rules.append(Rule("\\b" "check_batch" "\\b", format));
+    rules.append(Rule("\\b" "meta" "\\b", format));
+    rules.append(Rule("\\b" "tile" "\\b", format));
     rules.append(Rule("\\b" "getBiomeAt" "\\b", format));
+    rules.append(Rule("\\b" "getBiomeArea" "\\b", format));
+    rules.append(Rule("\\b" "getClimateArea" "\\b", format));
+    rules.append(Rule("\\b" "getHeightArea" "\\b", format));
 
     format.setFontWeight(QFont::Normal);
     format.setForeground(QColor(0, 160, 0));
@@ -605,6 +1624,12 @@ void ScriptEditor::paintLineNumbers(QPaintEvent *event)
     {
         if (block.isVisible() && bottom >= event->rect().top())
         {
+            auto it = lineheat.find(blockNumber + 1);
+            if (it != lineheat.end())
+            {
+                QColor heat = QColor(255, 0, 0, 32 + (int)(192 * it.value()));
+                painter.fillRect(0, top, lineNumberArea->width(), bottom - top, heat);
+            }
             QString number = QString::number(blockNumber + 1);
             painter.drawText(0, top, lineNumberArea->width(), fontMetrics().height(), Qt::AlignRight, number);
         }
@@ -615,6 +1640,17 @@ void ScriptEditor::paintLineNumbers(QPaintEvent *event)
     }
 }
 
+void ScriptEditor::setLineSamples(const std::map<int, uint64_t>& samples)
+{
+    lineheat.clear();
+    uint64_t smax = 0;
+    for (const auto& it : samples)
+        smax = std::max(smax, it.second);
+    for (const auto& it : samples)
+        lineheat[it.first] = (qreal) it.second / smax;
+    lineNumberArea->update();
+}
+
 void ScriptEditor::keyPressEvent(QKeyEvent *event)
 {
     if (event->key() == Qt::Key_Return)
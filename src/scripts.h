@@ -10,12 +10,15 @@
 #include <QSyntaxHighlighter>
 #include <QRegularExpression>
 
+#include "search.h"
+
 #include "cubiomes/finders.h"
 
 #include "lua/src/lua.hpp"
 
 struct SearchThreadEnv;
 struct Condition;
+struct LuaBatch;
 
 // store script output/errors per condition save index
 struct LuaOutput
@@ -42,12 +45,65 @@ struct LuaOutput
 };
 extern LuaOutput g_lua_output[100];
 
+// store the sampled script profile of the last search per condition save index
+struct LuaProfileOutput
+{
+    uint64_t hash;
+    LuaProfile prof;
+    QMutex mutex;
+    LuaProfileOutput() : hash(), prof(), mutex() {}
+    void add(uint64_t h, const LuaProfile& p)
+    {
+        QMutexLocker locker(&mutex);
+        if (h != hash)
+            prof = LuaProfile();
+        hash = h;
+        prof.add(p);
+    }
+    void clear()
+    {
+        QMutexLocker locker(&mutex);
+        hash = 0;
+        prof = LuaProfile();
+    }
+};
+extern LuaProfileOutput g_lua_profile[100];
+
+// summary of a profile, listing up to maxlines of the most sampled lines
+QString formatLuaProfile(const LuaProfile& p, int maxlines);
+
 QString getLuaDir();
 uint64_t getScriptHash(QFileInfo path);
 
+// gets the scripts in the Lua directory (hash => path) from the registry
 void getScripts(QMap<uint64_t, QString>& scripts);
+QString getScriptPath(uint64_t hash);
+// marks the script registry for a rescan, e.g. after a script was created
+void invalidateScripts();
+
+// Script states are pooled per script hash and reused across searches. A
+// script is compiled to bytecode once and only recompiled when the file
+// changes, at which point the pooled states of the old version are retired.
+// A state from acquireScript() is given back with releaseScript().
+lua_State *acquireScript(uint64_t hash, const QString& path, QString *err = 0);
+void releaseScript(lua_State *L);
+
+// installs the count hook for instruction budgets, stop signals and profiling
+void setScriptHook(lua_State *L);
 
-lua_State *loadScript(QString path, QString *err = 0);
+// gets the meta table declarations of a script, as read when it was loaded
+LuaMeta getScriptMeta(lua_State *L);
+
+// allocation statistics of a pooled script state since it was acquired
+struct LuaAllocStats
+{
+    uint64_t allocs;    // allocations and growing reallocations
+    uint64_t pooled;    // allocations served from the size class free lists
+    uint64_t bytes;     // bytes in use
+    uint64_t peak;      // peak bytes in use
+    uint64_t reserved;  // bytes reserved in chunks for the size classes
+};
+bool getScriptAllocStats(lua_State *L, LuaAllocStats *stats);
 
 // tries to run a lua check function
 int runCheckScript(
@@ -59,6 +115,24 @@ int runCheckScript(
         const Condition   * cond
 );
 
+// checks if the script defines the optional check_batch() function
+bool hasCheckBatch(lua_State *L);
+bool hasScriptFunction(lua_State *L, const char *name);
+
+// Evaluates the tile() function of an overlay script for the area r, with a
+// pooled state of the script. The w*h values are written to values (NaN for
+// no value), together with the value range for the color map.
+bool runTileScript(uint64_t hash, const QString& path, int mc, bool large, uint64_t seed,
+        Range r, std::atomic_bool *stop, float *values, float *vmin, float *vmax, QString *err);
+
+// Queues a check of the current seed of the environment for check_batch(),
+// with the dependent positions from path. The queued checks of a seed can be
+// withdrawn with dropCheckBatch(), while runCheckBatch() evaluates all queued
+// checks in one call, clearing ok[i] for each check that failed.
+void queueCheckBatch(LuaBatch& batch, Pos at, SearchThreadEnv *env, const Pos *path);
+void dropCheckBatch(LuaBatch& batch, uint64_t seed);
+void runCheckBatch(LuaBatch& batch, SearchThreadEnv *env, char *ok);
+
 struct Rule
 {
     QRegularExpression pattern;
@@ -102,6 +176,9 @@ public:
     void paintLineNumbers(QPaintEvent *event);
     int lineNumberAreaWidth();
 
+    // marks the hot lines of a script profile in the line number area
+    void setLineSamples(const std::map<int, uint64_t>& samples);
+
     void resizeEvent(QResizeEvent *event) override;
     void keyPressEvent(QKeyEvent *event) override;
 
@@ -113,6 +190,7 @@ private slots:
 private:
     QWidget *lineNumberArea;
     LuaHighlighter *highlighter;
+    QMap<int, qreal> lineheat; // relative samples per line number
 };
 
 #endif // SCRIPTS_H
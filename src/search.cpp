@@ -16,6 +16,8 @@
 #include <QThread>
 
 #include <algorithm>
+#include <thread>
+#include <unordered_map>
 
 #define MULTIPLY_CHAR QChar(0xD7)
 
@@ -51,10 +53,9 @@ QString Condition::summary(bool aligntab) const
         txts = QApplication::translate("Filter", ft.name);
         if (type == F_LUA)
         {
-            QMap<uint64_t, QString> scripts;
-            getScripts(scripts);
-            if (scripts.contains(hash))
-                txts += ": " + QFileInfo(scripts.value(hash)).baseName();
+            QString path = getScriptPath(hash);
+            if (!path.isEmpty())
+                txts += ": " + QFileInfo(path).baseName();
             else
                 txts += ": " + QApplication::translate("Filter", "[script missing]");
         }
@@ -254,19 +255,46 @@ SearchThreadEnv::SearchThreadEnv()
 , large()
 , seed()
 , surfdim(DIM_UNDEF)
+, surfseed()
 , octaves()
+, dimseed()
+, dimvalid()
+, reseeds()
+, condstats()
+, countstats()
 , searchpass(PASS_FAST_48)
 , stop()
 , l_states()
+, l_meta()
+, l_seed48()
+, l_cache48()
+, l_reach()
+, l_at()
+, l_defer()
+, l_batchrun()
+, l_batches()
+, l_budget()
+, l_profile()
+, l_count()
+, l_limit()
+, l_abort()
+, l_cond()
+, l_prof()
+, spawnvalid()
+, spawn()
+, shinit()
+, shdone()
+, strongholds()
 {
     memset(&g, 0, sizeof(g));
     memset(&sn, 0, sizeof(sn));
+    memset(&shiter, 0, sizeof(shiter));
 }
 
 SearchThreadEnv::~SearchThreadEnv()
 {
     for (auto& it : l_states)
-        lua_close(it.second);
+        releaseScript(it.second);
 }
 
 QString SearchThreadEnv::init(int mc, bool large, const ConditionTree& condtree)
@@ -277,53 +305,230 @@ QString SearchThreadEnv::init(int mc, bool large, const ConditionTree& condtree)
     this->seed = 0;
     this->surfdim = DIM_UNDEF;
     this->octaves = 0;
+    for (int i = 0; i < 3; i++)
+        this->dimvalid[i] = false;
+    memset(&this->reseeds, 0, sizeof(this->reseeds));
+    this->condstats.assign(condtree.condvec.size(), CondStats());
+    this->countstats = g_condstats;
+    this->spawnvalid = false;
+    this->shinit = false;
+    this->viablecache.clear();
+    this->terraincache.clear();
     uint32_t flags = 0;
     if (large)
         flags |= LARGE_BIOMES;
     setupGenerator(&g, mc, flags);
 
-    QMap<uint64_t, QString> scripts;
-    getScripts(scripts);
     for (auto& it : l_states)
-        lua_close(it.second);
+        releaseScript(it.second);
     l_states.clear();
+    l_meta.clear();
+    l_cache48.clear();
+    l_reach = 0;
+    l_defer = false;
+    l_batches.clear();
+    l_budget = g_luabudget;
+    l_profile = g_luaprofiling;
+    l_prof.clear();
 
+    QMap<uint64_t, QString> scripts;
+    bool scanned = false;
     for (const Condition& c: condtree.condvec)
     {
         if (c.type != F_LUA)
             continue;
+        if (!scanned)
+        {   // only look for scripts when they are needed
+            getScripts(scripts);
+            scanned = true;
+        }
         if (!scripts.contains(c.hash))
             return QApplication::translate("Filter", "missing script for condition %1").arg(c.save);
-        QString err;
-        lua_State *L = loadScript(scripts.value(c.hash), &err);
+        lua_State *L = l_states[c.hash];
         if (!L)
+        {   // conditions with the same script share a state
+            QString err;
+            L = acquireScript(c.hash, scripts.value(c.hash), &err);
+            if (!L)
+            {
+                l_states.erase(c.hash);
+                QString s = QApplication::translate("Filter", "Condition %1:\n").arg(c.save);
+                s += err;
+                return s;
+            }
+            l_states[c.hash] = L;
+            if (!hasScriptFunction(L, "check"))
+            {   // e.g. a script for map overlays
+                QString s = QApplication::translate("Filter", "Condition %1:\n").arg(c.save);
+                s += QApplication::translate("Filter", "function check() was not defined");
+                return s;
+            }
+            l_meta[c.hash] = getScriptMeta(L);
+            setScriptHook(L);
+        }
+        if (c.relative == 0 && hasCheckBatch(L))
         {
-            QString s = QApplication::translate("Filter", "Condition %1:\n").arg(c.save);
-            s += err;
-            return s;
+            LuaBatch batch;
+            batch.cond = &this->condtree.condvec[c.save];
+            batch.L = L;
+            l_batches.push_back(batch);
+        }
+    }
+
+    if (!l_meta.empty())
+    {   // Order the sibling conditions by the declared cost of the scripts,
+        // so cheap scripts are tested before the built-in filters and
+        // expensive ones after. Only the children that are combined via AND
+        // are reordered: a script receives its whole subtree of dependencies
+        // in their order, a NOT returns the verdict of its first decisive
+        // child and an OR keeps the positions of its first match.
+        ConditionTree& tree = this->condtree;
+        auto cost = [&](char i) {
+            const Condition& c = tree.condvec[i];
+            return c.type == F_LUA ? l_meta[c.hash].cost : (int) LuaMeta::COST_MEDIUM;
+        };
+        int n = tree.references.size();
+        std::vector<char> inlua(n, 0);
+        std::vector<int> stack;
+        for (int i = 0; i < n; i++)
+        {
+            if (tree.condvec[i].type != F_LUA)
+                continue;
+            stack.assign(1, i);
+            while (!stack.empty())
+            {
+                int j = stack.back();
+                stack.pop_back();
+                for (char b : tree.references[j])
+                {
+                    if (!inlua[b])
+                    {
+                        inlua[b] = 1;
+                        stack.push_back(b);
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < n; i++)
+        {
+            int type = tree.condvec[i].type;
+            if (type == F_LUA || type == F_LOGIC_NOT || type == F_LOGIC_OR || inlua[i])
+                continue;
+            std::vector<char>& refs = tree.references[i];
+            std::stable_sort(refs.begin(), refs.end(),
+                [&](char a, char b) { return cost(a) < cost(b); });
         }
-        l_states[c.hash] = L;
     }
     return "";
 }
 
+void LuaProfile::add(const LuaProfile& p)
+{
+    calls += p.calls;
+    instructions += p.instructions;
+    overruns += p.overruns;
+    allocs += p.allocs;
+    pooled += p.pooled;
+    if (p.peakmem > peakmem)
+        peakmem = p.peakmem;
+    for (const auto& it : p.lines)
+        lines[it.first] += it.second;
+}
+
+void SearchThreadEnv::flushLuaProfile()
+{
+    // the allocation stats are kept per state, which the conditions with the
+    // same script share, so the counts are split by the calls of each
+    std::map<uint64_t, uint64_t> calls;
+    for (const auto& it : l_prof)
+        calls[condtree.condvec[it.first].hash] += it.second.calls;
+
+    for (auto& it : l_prof)
+    {
+        const Condition& c = condtree.condvec[it.first];
+        LuaAllocStats stats;
+        auto sit = l_states.find(c.hash);
+        if (sit != l_states.end() && sit->second && getScriptAllocStats(sit->second, &stats))
+        {
+            uint64_t total = calls[c.hash];
+            double frac = total ? (double) it.second.calls / total : 0;
+            it.second.allocs = (uint64_t) (stats.allocs * frac + 0.5);
+            it.second.pooled = (uint64_t) (stats.pooled * frac + 0.5);
+            it.second.peakmem = stats.peak;
+        }
+        g_lua_profile[c.save].add(c.hash, it.second);
+    }
+    l_prof.clear();
+}
+
+void SearchThreadEnv::runLuaBatches(std::vector<char>& ok)
+{
+    ok.assign(l_batches.empty() ? 0 : l_batches[0].queries.size(), 1);
+    uint64_t s = seed;
+    for (LuaBatch& batch : l_batches)
+    {
+        if (batch.queries.size() != ok.size())
+        {   // should not happen: every queued seed has one query per batch
+            ok.assign(ok.size(), 0);
+            batch.queries.clear();
+            batch.nodes.clear();
+            continue;
+        }
+        runCheckBatch(batch, this, ok.data());
+    }
+    if (seed != s) // the script may have switched seeds
+        setSeed(s);
+}
+
 void SearchThreadEnv::setSeed(uint64_t seed)
 {
     this->seed = seed;
     this->octaves = 0;
+    this->spawnvalid = false;
+    this->shinit = false;
+    if (!this->viablecache.empty())
+        this->viablecache.clear();
+    if (!this->terraincache.empty())
+        this->terraincache.clear();
+    if ((seed ^ this->l_seed48) & MASK48 || this->l_cache48.size() > 0x10000)
+    {
+        if (!this->l_cache48.empty())
+            this->l_cache48.clear();
+        this->l_seed48 = seed;
+    }
 }
 
 void SearchThreadEnv::init4Dim(int dim)
 {
     uint64_t mask = (dim == DIM_OVERWORLD ? ~0ULL : MASK48);
-    if (dim != g.dim || (seed & mask) != (g.seed & mask))
+    int i = dim + 1;
+    if (i < 0 || i >= 3)
     {
         applySeed(&g, dim, seed);
-        this->surfdim = DIM_UNDEF;
+        return;
+    }
+    if (!dimvalid[i] || (seed & mask) != (dimseed[i] & mask))
+    {   // the dimension-specific generator state has to be reseeded
+        applySeed(&g, dim, seed);
+        dimseed[i] = seed;
+        dimvalid[i] = true;
+        if (dim == DIM_OVERWORLD)
+            reseeds.seed64++;
+        else
+            reseeds.seed48++;
+        return;
     }
-    else if (g.mc >= MC_1_15 && seed != g.seed)
+    // the state is still valid, but the generator may have been used for
+    // another dimension or the upper 16 bits of the seed might have changed
+    g.dim = dim;
+    if (seed != g.seed)
     {
-        g.sha = getVoronoiSHA(seed);
+        if (g.mc >= MC_1_15)
+        {
+            g.sha = getVoronoiSHA(seed);
+            reseeds.sha++;
+        }
+        g.seed = seed;
     }
 }
 
@@ -333,19 +538,146 @@ void SearchThreadEnv::init4Noise(int nptype, int octaves)
         octaves = INT_MAX;
     if (g.bn.nptype == nptype && this->octaves == octaves)
         return; // already initialized for parameter
-    if (seed == g.seed && g.bn.nptype == -1)
+    if (dimvalid[DIM_OVERWORLD+1] && dimseed[DIM_OVERWORLD+1] == seed && g.bn.nptype == -1)
         return; // fully initialized biome noise
     setClimateParaSeed(&g.bn, seed, large, nptype, octaves);
     this->octaves = octaves;
+    // the biome noise is now only partially initialized
+    this->dimvalid[DIM_OVERWORLD+1] = false;
 }
 
 void SearchThreadEnv::prepareSurfaceNoise(int dim)
 {
-    if (surfdim != dim)
+    uint64_t mask = (dim == DIM_OVERWORLD ? ~0ULL : MASK48);
+    if (surfdim != dim || ((surfseed ^ seed) & mask))
     {
         initSurfaceNoise(&sn, dim, seed);
         surfdim = dim;
+        surfseed = seed;
+    }
+}
+
+int SearchThreadEnv::isViableTerrain(int stype, int x, int z)
+{
+    uint64_t key = ((uint64_t)stype << 56) |
+        ((uint64_t)(x & 0xfffffff) << 28) | (uint64_t)(z & 0xfffffff);
+    auto it = terraincache.find(key);
+    if (it != terraincache.end())
+        return it->second;
+    int ok;
+    if (stype == End_City)
+    {
+        prepareSurfaceNoise(DIM_END);
+        ok = isViableEndCityTerrain(&g, &sn, x, z);
+    }
+    else
+    {
+        ok = isViableStructureTerrain(stype, &g, x, z);
+    }
+    terraincache[key] = ok;
+    return ok;
+}
+
+int SearchThreadEnv::isViableStructure(int stype, int dim, int x, int z)
+{
+    uint64_t key = ((uint64_t)stype << 56) |
+        ((uint64_t)(x & 0xfffffff) << 28) | (uint64_t)(z & 0xfffffff);
+    auto it = viablecache.find(key);
+    if (it != viablecache.end())
+        return it->second;
+    init4Dim(dim);
+    int id = isViableStructurePos(stype, &g, x, z, 0);
+    viablecache[key] = id;
+    return id;
+}
+
+Pos SearchThreadEnv::getSpawn()
+{
+    if (!spawnvalid)
+    {
+        init4Dim(DIM_OVERWORLD);
+        spawn = ::getSpawn(&g);
+        spawnvalid = true;
+    }
+    return spawn;
+}
+
+const SearchThreadEnv::StrongholdInfo *SearchThreadEnv::getStronghold(int i)
+{
+    if (!shinit)
+    {
+        initFirstStronghold(&shiter, mc, seed);
+        strongholds.clear();
+        shinit = true;
+        shdone = false;
+    }
+    while ((int) strongholds.size() <= i && !shdone)
+    {
+        init4Dim(DIM_OVERWORLD);
+        if (nextStronghold(&shiter, &g) > 0)
+            strongholds.push_back(StrongholdInfo{ shiter.pos, shiter.ringnum });
+        else
+            shdone = true;
     }
+    if (i < (int) strongholds.size())
+        return &strongholds[i];
+    return NULL;
+}
+
+struct TerrainEntry
+{
+    uint64_t seed;
+    uint64_t key;   // (stype, x, z)
+    int mc;
+    uint32_t flags;
+    int result;
+    int used;
+};
+
+static QMutex g_terrain_mutex;
+static std::vector<TerrainEntry> g_terrain_cache; // allocated on first use
+
+static uint64_t getTerrainKey(int stype, int x, int z)
+{   // positions are within +/-3e7 and fit into 28 bits each
+    return ((uint64_t)(stype & 0xff) << 56) |
+        ((uint64_t)(x & 0xfffffff) << 28) | (uint64_t)(z & 0xfffffff);
+}
+
+static size_t getTerrainSlot(uint64_t seed, uint64_t key)
+{
+    uint64_t h = seed ^ (key * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 29;
+    return h % g_terrain_cache.size();
+}
+
+bool getCachedTerrain(const Generator *g, int stype, int x, int z, int *result)
+{
+    uint64_t key = getTerrainKey(stype, x, z);
+    QMutexLocker locker(&g_terrain_mutex);
+    if (g_terrain_cache.empty())
+        return false;
+    const TerrainEntry& e = g_terrain_cache[getTerrainSlot(g->seed, key)];
+    if (!e.used || e.seed != g->seed || e.key != key || e.mc != g->mc || e.flags != g->flags)
+        return false;
+    *result = e.result;
+    return true;
+}
+
+void setCachedTerrain(const Generator *g, int stype, int x, int z, int result)
+{
+    uint64_t key = getTerrainKey(stype, x, z);
+    QMutexLocker locker(&g_terrain_mutex);
+    if (g_terrain_cache.empty())
+        g_terrain_cache.resize(TERRAIN_CACHE_BUFSIZ / sizeof(TerrainEntry));
+    TerrainEntry& e = g_terrain_cache[getTerrainSlot(g->seed, key)];
+    e.seed = g->seed;
+    e.key = key;
+    e.mc = g->mc;
+    e.flags = g->flags;
+    e.result = result;
+    e.used = 1;
 }
 
 // The position buffers can exceed the stacksize on some platforms,
@@ -361,12 +693,34 @@ static Pos* getPosBuf(uint32_t node)
 }
 
 static
+int _testNodeAt(Pos at, SearchThreadEnv *env, Pos *path, int node);
+
+// tests a node of the condition tree and keeps count for the statistics
+static inline
 int _testTreeAt(
     Pos                         at,             // relative origin
     SearchThreadEnv           * env,            // thread-local environment
     Pos                       * path,           // output center position(s)
     int                         node
 )
+{
+    int st = _testNodeAt(at, env, path, node);
+    if (env->countstats)
+    {
+        SearchThreadEnv::CondStats& cs = env->condstats[node];
+        cs.tests++;
+        cs.fails += (st == COND_FAILED);
+    }
+    return st;
+}
+
+static
+int _testNodeAt(
+    Pos                         at,             // relative origin
+    SearchThreadEnv           * env,            // thread-local environment
+    Pos                       * path,           // output center position(s)
+    int                         node
+)
 {
     const ConditionTree *tree = &env->condtree;
     const Condition& c = tree->condvec[node];
@@ -572,7 +926,23 @@ int _testTreeAt(
             }
             if (st <= COND_MAYBE_POS_INVAL)
                 return st;
-            int sta = runCheckScript(L, at, env, env->searchpass, buf, &c);
+            int pass = env->searchpass;
+            if (pass == PASS_FULL_48 && env->l_meta[c.hash].dep64 > 0)
+            {   // the check needs the full seed, so at most check48() applies
+                pass = PASS_FAST_48;
+            }
+            if (env->l_defer && c.relative == 0 && pass == PASS_FULL_64)
+            {
+                for (LuaBatch& batch : env->l_batches)
+                {
+                    if (batch.cond->save == c.save)
+                    {   // check later with the other queued seeds
+                        queueCheckBatch(batch, at, env, buf);
+                        return st;
+                    }
+                }
+            }
+            int sta = runCheckScript(L, at, env, pass, buf, &c);
             if (*env->stop)
                 return COND_FAILED;
             if (sta < st)
@@ -687,7 +1057,13 @@ int testTreeAt(
             return st;
     }
     env->searchpass = pass;
-    return _testTreeAt(at, env, path, 0);
+    int st = _testTreeAt(at, env, path, 0);
+    if (env->l_defer && st != COND_OK)
+    {   // withdraw the deferred checks of a failed seed
+        for (LuaBatch& batch : env->l_batches)
+            dropCheckBatch(batch, env->seed);
+    }
+    return st;
 }
 
 
@@ -1351,13 +1727,12 @@ L_qm_any:
                     }
 
                     env->init4Dim(finfo.dim);
-                    int id = isViableStructurePos(st, &env->g, pc.x, pc.z, 0);
+                    int id = env->isViableStructure(st, finfo.dim, pc.x, pc.z);
                     if (!id)
                         continue;
                     if (st == End_City)
                     {
-                        env->prepareSurfaceNoise(DIM_END);
-                        if (!isViableEndCityTerrain(&env->g, &env->sn, pc.x, pc.z))
+                        if (!env->isViableTerrain(st, pc.x, pc.z))
                             continue;
                     }
                     if (cond->varflags)
@@ -1367,8 +1742,8 @@ L_qm_any:
                     }
                     if (env->mc >= MC_1_18)
                     {
-                        if (g_extgen.estimateTerrain &&
-                            !isViableStructureTerrain(st, &env->g, pc.x, pc.z))
+                        if (g_extgen.estimateTerrain && st != End_City &&
+                            !env->isViableTerrain(st, pc.x, pc.z))
                         {
                             continue;
                         }
@@ -1523,8 +1898,7 @@ L_qm_any:
             return COND_MAYBE_POS_INVAL;
 
         if (*env->stop) return COND_FAILED;
-        env->init4Dim(DIM_OVERWORLD);
-        pc = getSpawn(&env->g);
+        pc = env->getSpawn();
         if (rmax)
         {
             int dx = pc.x - at.x;
@@ -1654,29 +2028,28 @@ L_qm_any:
             else
                 rmax = 0;
 
-            StrongholdIter sh;
-            initFirstStronghold(&sh, env->mc, env->seed);
+            // the strongholds are shared between conditions of the same seed
+            const SearchThreadEnv::StrongholdInfo *sh;
             icnt = 0;
             xt = zt = 0;
-            env->init4Dim(DIM_OVERWORLD);
-            while (nextStronghold(&sh, &env->g) > 0)
+            for (i = 0; (sh = env->getStronghold(i)) != NULL; i++)
             {
                 if (*env->stop)
                     break;
                 bool inside;
                 if (rmax)
                 {
-                    int dx = sh.pos.x - at.x;
-                    int dz = sh.pos.z - at.z;
+                    int dx = sh->pos.x - at.x;
+                    int dz = sh->pos.z - at.z;
                     int64_t rsq = dx*(int64_t)dx + dz*(int64_t)dz;
                     inside = (rsq < rmax);
                 }
                 else
                 {
-                    inside = (sh.pos.x >= x1 && sh.pos.x <= x2 &&
-                              sh.pos.z >= z1 && sh.pos.z <= z2);
+                    inside = (sh->pos.x >= x1 && sh->pos.x <= x2 &&
+                              sh->pos.z >= z1 && sh->pos.z <= z2);
                 }
-                if (cond->skipref && sh.pos.x == at.x && sh.pos.z == at.z)
+                if (cond->skipref && sh->pos.x == at.x && sh->pos.z == at.z)
                     inside = false;
                 if (inside)
                 {
@@ -1686,19 +2059,19 @@ L_qm_any:
                     }
                     else if (imax)
                     {
-                        cent[icnt] = sh.pos;
+                        cent[icnt] = sh->pos;
                         icnt++;
                         if (icnt >= *imax)
                             return COND_OK;
                     }
                     else
                     {
-                        xt += sh.pos.x;
-                        zt += sh.pos.z;
+                        xt += sh->pos.x;
+                        zt += sh->pos.z;
                         icnt++;
                     }
                 }
-                if (sh.ringnum > r)
+                if (sh->ringnum > r)
                     break;
             }
             if (cond->count == 0)
@@ -2249,8 +2622,247 @@ void findQuadStructs(int styp, Generator *g, QVector<QuadInfo> *out)
 }
 
 
+static const uint64_t JAVA_MUL = 0x5deece66dULL;
+static const uint64_t JAVA_ADD = 0xb;
+
+// The maximum number of 48-bit seeds the solver is allowed to test after the
+// lower bits have been lifted. (About a minute on a typical desktop CPU.)
+#define SOLVE48_MAXWORK (1ULL << 38)
+
+int getPinnedStructs(std::vector<PinnedStruct>& out, const std::vector<Condition>& cv, int mc)
+{
+    out.clear();
+    if (mc < MC_1_8)
+        return 0;
+
+    for (const Condition& c : cv)
+    {
+        if (c.meta & Condition::DISABLED)
+            continue;
+        // only inclusion areas of root conditions are absolute constraints
+        if (c.relative != 0 || c.rmax > 0 || c.count <= 0)
+            continue;
+
+        switch (c.type)
+        {
+        // structures placed by a single feature roll within their region
+        case F_DESERT:
+        case F_HUT:
+        case F_JUNGLE:
+        case F_IGLOO:
+        case F_VILLAGE:
+        case F_OUTPOST:
+        case F_RUINS:
+        case F_SHIPWRECK:
+        case F_PORTAL:
+        case F_PORTALN:
+        case F_ANCIENT_CITY:
+        case F_TRAILS:
+            break;
+        default:
+            continue;
+        }
+
+        PinnedStruct p;
+        p.stype = g_filterinfo.list[c.type].stype;
+        if (!getStructureConfig_override(p.stype, mc, &p.sconf))
+            continue;
+        int rsiz = p.sconf.regionSize;
+        p.rx = floordiv(c.x1, rsiz << 4);
+        p.rz = floordiv(c.z1, rsiz << 4);
+        if (p.rx != floordiv(c.x2, rsiz << 4) || p.rz != floordiv(c.z2, rsiz << 4))
+            continue;
+        // structures are placed at chunk origins
+        p.cx1 = ((c.x1 + 15) >> 4) - p.rx * rsiz;
+        p.cz1 = ((c.z1 + 15) >> 4) - p.rz * rsiz;
+        p.cx2 = (c.x2 >> 4) - p.rx * rsiz;
+        p.cz2 = (c.z2 >> 4) - p.rz * rsiz;
+        if (p.cx1 < 0) p.cx1 = 0;
+        if (p.cz1 < 0) p.cz1 = 0;
+        if (p.cx2 >= p.sconf.chunkRange) p.cx2 = p.sconf.chunkRange - 1;
+        if (p.cz2 >= p.sconf.chunkRange) p.cz2 = p.sconf.chunkRange - 1;
+        p.x1 = c.x1;
+        p.z1 = c.z1;
+        p.x2 = c.x2;
+        p.z2 = c.z2;
+        out.push_back(p);
+    }
+
+    auto frac = [](const PinnedStruct& p) {
+        double r = p.sconf.chunkRange;
+        double w = p.cx2 - p.cx1 + 1;
+        double h = p.cz2 - p.cz1 + 1;
+        if (w <= 0 || h <= 0)
+            return 0.0;
+        return (w * h) / (r * r);
+    };
+    std::stable_sort(out.begin(), out.end(),
+        [&](const PinnedStruct& a, const PinnedStruct& b) { return frac(a) < frac(b); });
+
+    return (int) out.size();
+}
+
+uint64_t estimatePinned48(const std::vector<PinnedStruct>& pins)
+{
+    double cnt = MASK48 + 1.0;
+    for (const PinnedStruct& p : pins)
+    {
+        double r = p.sconf.chunkRange;
+        double w = p.cx2 - p.cx1 + 1;
+        double h = p.cz2 - p.cz1 + 1;
+        if (w <= 0 || h <= 0)
+            return 0;
+        cnt *= (w * h) / (r * r);
+    }
+    return (uint64_t) ceil(cnt);
+}
+
+// Java's nextInt(r) as used by getFeatureChunkInRegion().
+static inline int pinnedNextInt(uint64_t *rng, uint64_t r)
+{
+    *rng = (*rng * JAVA_MUL + JAVA_ADD) & MASK48;
+    if (r & (r-1))
+        return (int)(*rng >> 17) % r;
+    return (int)((r * (*rng >> 17)) >> 31);
+}
+
+static inline bool testPinned(const PinnedStruct& p, uint64_t s48)
+{
+    uint64_t rng = s48 + p.rx*341873128712ULL + p.rz*132897987541ULL + p.sconf.salt;
+    rng = (rng ^ JAVA_MUL) & MASK48;
+    int cx = pinnedNextInt(&rng, p.sconf.chunkRange);
+    if (cx < p.cx1 || cx > p.cx2)
+        return false;
+    int cz = pinnedNextInt(&rng, p.sconf.chunkRange);
+    return cz >= p.cz1 && cz <= p.cz2;
+}
+
+bool solvePinned48(
+    std::vector<uint64_t>     & list48,
+    const std::vector<PinnedStruct>& pins,
+    int                         mc,
+    int                         threads,
+    uint64_t                    bufmax,
+    std::atomic_bool          * stop
+    )
+{
+    list48.clear();
+    if (pins.empty())
+        return false;
+    for (const PinnedStruct& p : pins)
+        if (p.cx1 > p.cx2 || p.cz1 > p.cz2)
+            return true; // cannot be satisfied by any seed
+    if (estimatePinned48(pins) * sizeof(uint64_t) >= bufmax)
+        return false;
+
+    // For a range r = m * 2^k with an odd m, nextInt(r) retains the lowest
+    // k bits of the random output, which in turn only depend on the lowest
+    // 17+k bits of the seed. These lower bits can be lifted on their own.
+    int n = (int) pins.size();
+    std::vector<int> kbits(n);
+    std::vector<uint32_t> xres(n), zres(n);
+    int kmax = 0;
+    for (int i = 0; i < n; i++)
+    {
+        const PinnedStruct& p = pins[i];
+        int r = p.sconf.chunkRange;
+        int k = (r & (r-1)) ? __builtin_ctz(r) : 0;
+        if (k > 5)
+            k = 5;
+        uint32_t km = (1U << k) - 1;
+        xres[i] = zres[i] = 0;
+        for (int cx = p.cx1; cx <= p.cx2; cx++)
+            xres[i] |= 1U << (cx & km);
+        for (int cz = p.cz1; cz <= p.cz2; cz++)
+            zres[i] |= 1U << (cz & km);
+        kbits[i] = k;
+        if (k > kmax)
+            kmax = k;
+    }
+
+    int lbits = 17 + kmax;
+    uint64_t lmask = (1ULL << lbits) - 1;
+    std::vector<uint64_t> lows;
+    for (uint64_t low = 0; low <= lmask; low++)
+    {
+        int i;
+        for (i = 0; i < n; i++)
+        {
+            const PinnedStruct& p = pins[i];
+            int k = kbits[i];
+            if (k == 0)
+                continue;
+            uint64_t km = (1ULL << k) - 1;
+            uint64_t rng = low + p.rx*341873128712ULL + p.rz*132897987541ULL + p.sconf.salt;
+            rng = (rng ^ JAVA_MUL) & lmask;
+            rng = (rng * JAVA_MUL + JAVA_ADD) & lmask;
+            if (!((xres[i] >> ((rng >> 17) & km)) & 1))
+                break;
+            rng = (rng * JAVA_MUL + JAVA_ADD) & lmask;
+            if (!((zres[i] >> ((rng >> 17) & km)) & 1))
+                break;
+        }
+        if (i == n)
+            lows.push_back(low);
+    }
 
+    uint64_t hcnt = 1ULL << (48 - lbits);
+    if (lows.empty())
+        return true;
+    if ((uint64_t) lows.size() > SOLVE48_MAXWORK / hcnt)
+        return false;
 
+    if (threads < 1)
+        threads = 1;
+    std::vector<std::vector<uint64_t>> found(threads);
+    std::vector<std::thread> workers;
 
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]() {
+            std::vector<uint64_t>& out = found[t];
+            uint64_t iter = 0;
+            for (uint64_t h = t; h < hcnt; h += threads)
+            {
+                if ((++iter & 0x3ff) == 0 && *stop)
+                    break;
+                for (uint64_t low : lows)
+                {
+                    uint64_t s48 = (h << lbits) | low;
+                    int i;
+                    for (i = 0; i < n; i++)
+                        if (!testPinned(pins[i], s48))
+                            break;
+                    if (i < n)
+                        continue;
+                    // confirm with the generator the search itself uses
+                    for (i = 0; i < n; i++)
+                    {
+                        const PinnedStruct& p = pins[i];
+                        Pos pos;
+                        if (!getStructurePos(p.stype, mc, s48, p.rx, p.rz, &pos))
+                            break;
+                        if (pos.x < p.x1 || pos.x > p.x2 || pos.z < p.z1 || pos.z > p.z2)
+                            break;
+                    }
+                    if (i == n)
+                        out.push_back(s48);
+                }
+            }
+        });
+    }
+    for (std::thread& w : workers)
+        w.join();
 
+    if (*stop)
+        return false;
 
+    size_t total = 0;
+    for (const std::vector<uint64_t>& v : found)
+        total += v.size();
+    list48.reserve(total);
+    for (const std::vector<uint64_t>& v : found)
+        list48.insert(list48.end(), v.begin(), v.end());
+    std::sort(list48.begin(), list48.end());
+    return true;
+}
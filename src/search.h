@@ -9,6 +9,8 @@
 #include <QString>
 #include <QMap>
 #include <atomic>
+#include <map>
+#include <unordered_map>
 
 enum
 {
@@ -648,6 +650,8 @@ static_assert(
 
 
 #define MAX_INSTANCES 4096 // should be at least 128
+#define LUA_BATCH_SIZE 256 // number of deferred seeds per check_batch() call
+#define LUA_HOOK_STEP 1000 // instructions between Lua hook calls
 
 enum
 {
@@ -673,6 +677,60 @@ struct ConditionTree
     QString set(const std::vector<Condition>& cv, int mc);
 };
 
+// dependent condition position, as passed to a Lua check
+struct LuaNode
+{
+    int x, z, id, parent;
+};
+
+// deferred check of a seed for check_batch()
+struct LuaQuery
+{
+    uint64_t seed;
+    Pos at;
+    int nodeidx, nodecnt;   // range of the dependent positions in nodes
+};
+
+struct LuaBatch
+{
+    const Condition *cond;
+    lua_State *L;
+    std::vector<LuaQuery> queries;
+    std::vector<LuaNode> nodes;
+};
+
+// Properties that a script declares in its global meta table, e.g.
+//  meta = { dep64 = false, reach = 2048, cost = "high" }
+struct LuaMeta
+{
+    enum { COST_LOW, COST_MEDIUM, COST_HIGH };
+    int dep64;  // depends on the upper 16 bits of the seed (-1 = undeclared)
+    int reach;  // max distance in blocks of queries and results (0 = unbounded)
+    int cost;   // cost of a check relative to the built-in filters
+    LuaMeta() : dep64(-1), reach(0), cost(COST_MEDIUM) {}
+};
+
+// cached check result of a script that only depends on the 48-bit seed
+struct LuaCached
+{
+    int st;
+    Pos pos;
+};
+
+// sampled runtime of the checks of a Lua condition
+struct LuaProfile
+{
+    uint64_t calls;
+    uint64_t instructions;      // counted in steps of LUA_HOOK_STEP
+    uint64_t overruns;          // calls that exceeded the instruction budget
+    uint64_t allocs, pooled;    // allocations (and those from the size classes)
+    uint64_t peakmem;           // largest peak memory of a state
+    std::map<int, uint64_t> lines; // samples per script line
+
+    LuaProfile() : calls(), instructions(), overruns(), allocs(), pooled(), peakmem(), lines() {}
+    void add(const LuaProfile& p);
+};
+
 struct SearchThreadEnv
 {
     ConditionTree condtree;
@@ -683,12 +741,68 @@ struct SearchThreadEnv
     int mc, large;
     uint64_t seed;
     int surfdim;
+    uint64_t surfseed;
     int octaves;
 
+    // The overworld generator depends on the full 64-bit seed, whereas the
+    // nether and end only use the lower 48 bits. The seed each dimension was
+    // initialized with is tracked, indexed by (dim+1).
+    uint64_t dimseed[3];
+    bool dimvalid[3];
+    struct ReseedStats
+    {
+        uint64_t seed64;    // overworld generator seeded (64-bit)
+        uint64_t seed48;    // nether or end generator seeded (48-bit)
+        uint64_t sha;       // only the voronoi hash was updated (64-bit)
+    } reseeds;
+    // number of tests and failures of each condition (by save id), which
+    // are only counted if countstats is set
+    struct CondStats { uint64_t tests, fails; };
+    std::vector<CondStats> condstats;
+    bool countstats;
+
     int searchpass;
     std::atomic_bool *stop;
 
     std::map<uint64_t, lua_State*> l_states;
+    std::map<uint64_t, LuaMeta> l_meta;
+
+    // Results of scripts that declare dep64 = false are kept for the
+    // current 48-bit seed base, keyed by condition, location and the
+    // dependent positions.
+    uint64_t l_seed48;
+    std::unordered_map<uint64_t, LuaCached> l_cache48;
+    // declared reach and location of the current check (l_reach = 0 outside)
+    int l_reach;
+    Pos l_at;
+
+    // Root level Lua conditions with a check_batch() function can be
+    // deferred (when l_defer is set by the search worker). The full 64-bit
+    // test then only queues them and the seeds that satisfy the remaining
+    // conditions are verified later, in batches, by runLuaBatches().
+    bool l_defer;
+    bool l_batchrun;
+    std::vector<LuaBatch> l_batches;
+
+    // A count hook on the Lua states aborts calls that exceed the
+    // instruction budget (l_budget, 0 = unlimited) or when the search is
+    // stopped, and samples the profile of the running condition.
+    int64_t l_budget;
+    bool l_profile;
+    int64_t l_count, l_limit;   // instructions and limit of the current call
+    int l_abort;                // reason for aborting the current call
+    const Condition *l_cond;    // condition of the current call
+    std::map<int, LuaProfile> l_prof; // profile by condition save index
+
+    // lazily evaluated results for the current seed (reset by setSeed)
+    struct StrongholdInfo { Pos pos; int ringnum; };
+    bool spawnvalid;
+    Pos spawn;
+    bool shinit, shdone;
+    StrongholdIter shiter;
+    std::vector<StrongholdInfo> strongholds;
+    std::unordered_map<uint64_t, int> viablecache; // (stype, x, z) => biome id
+    std::unordered_map<uint64_t, int> terraincache; // (stype, x, z) => viable terrain
 
     SearchThreadEnv();
     ~SearchThreadEnv();
@@ -699,8 +813,36 @@ struct SearchThreadEnv
     void init4Dim(int dim);
     void init4Noise(int nptype, int octaves);
     void prepareSurfaceNoise(int dim);
+
+    // Runs the deferred Lua checks of the queued seeds (in order of the
+    // queries) and sets ok[i] to whether the i-th queued seed passed.
+    void runLuaBatches(std::vector<char>& ok);
+    // adds the sampled Lua profiles to g_lua_profile and clears them
+    void flushLuaProfile();
+
+    // cached terrain viability of a structure at a position (MC 1.18+)
+    int isViableTerrain(int stype, int x, int z);
+    // Cached result of isViableStructurePos() for the current seed (the
+    // generator is initialized for the dimension on a cache miss).
+    int isViableStructure(int stype, int dim, int x, int z);
+
+    Pos getSpawn();
+    // Gets the stronghold with index i (in order of generation) together
+    // with the ring number of the iterator, resuming the stronghold iterator
+    // as required. Returns NULL if the iteration has no more strongholds.
+    const StrongholdInfo *getStronghold(int i);
 };
 
+/* The terrain viability checks for structures sample the surface noise and
+ * are among the most expensive checks. The searches cache them for the
+ * current seed of each thread (SearchThreadEnv::isViableTerrain), while the
+ * map tiles of the different threads share a process-wide cache. The shared
+ * cache is a fixed table of TERRAIN_CACHE_BUFSIZ bytes, indexed by a hash of
+ * the seed and position, where a new result replaces the one in its slot.
+ */
+bool getCachedTerrain(const Generator *g, int stype, int x, int z, int *result);
+void setCachedTerrain(const Generator *g, int stype, int x, int z, int result);
+
 /* Checks if a seed satisfies the conditions tree.
  * Returns the lowest condition fulfillment status.
  */
@@ -732,5 +874,38 @@ struct QuadInfo
 
 void findQuadStructs(int styp, Generator *g, QVector<QuadInfo> *out);
 
+/* A structure condition that confines an instance to an area within a single
+ * region restricts the lower 48-bits of the seed through the Java LCG that
+ * places the structure in that region. A few of these constraints can be
+ * solved for directly, rather than scanning the entire 48-bit space.
+ */
+struct PinnedStruct
+{
+    int stype;
+    StructureConfig sconf;
+    int rx, rz;                 // region coordinates
+    int cx1, cz1, cx2, cz2;     // chunk range within region (inclusive)
+    int x1, z1, x2, z2;         // block area of the condition (inclusive)
+};
+
+// Collects the root conditions that pin a structure, most restrictive first.
+int getPinnedStructs(std::vector<PinnedStruct>& out, const std::vector<Condition>& cv, int mc);
+
+// Estimates the number of 48-bit seeds that satisfy all the pinned structures.
+uint64_t estimatePinned48(const std::vector<PinnedStruct>& pins);
+
+/* Generates the sorted list of 48-bit seeds that satisfy the pinned structure
+ * positions. Returns false if the constraints are too weak to be solved
+ * within the buffer size (or if the solver was aborted).
+ */
+bool solvePinned48(
+    std::vector<uint64_t>     & list48,         // (out) sorted candidates
+    const std::vector<PinnedStruct>& pins,      // pinned structures
+    int                         mc,             // Minecraft version
+    int                         threads,        // number of worker threads
+    uint64_t                    bufmax,         // max buffer size in bytes
+    std::atomic_bool          * stop            // abort signal
+);
+
 
 #endif // SEARCH_H
@@ -0,0 +1,788 @@
+#include "searchserver.h"
+
+#include "message.h"
+
+#include <QHostAddress>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+/* Protocol of the distributed search, in lines of text:
+ *
+ * coordinator -> worker
+ *   SESSION <n>            followed by the n bytes of the session header
+ *   LIST <n> <m>           followed by the n candidates of the seed list and
+ *                          m original list indices (as binary 64-bit words)
+ *   LEASE <id> <prog> <idx> <sstart> <scnt> <seed>
+ *   END                    no more leases will be issued
+ *
+ * worker -> coordinator
+ *   HELLO <threads>
+ *   REQ <n>                requests n more leases
+ *   RES <seed> [<listidx>] a matching seed (with its list index, which is the
+ *                          original one if the coordinator has list indices)
+ *   DONE <id>              the lease has been processed
+ *   PING
+ *
+ * The binary words use the byte order of the coordinator.
+ */
+
+enum { BLOCK_NONE, BLOCK_SESSION, BLOCK_LIST };
+
+
+static QTextStream& qOut()
+{
+    static QTextStream out (stdout);
+    return out;
+}
+
+// Addresses of the form host:port (or :port) refer to TCP sockets,
+// anything else is the name of a local socket.
+static bool parseTcpAddr(const QString& addr, QString *host, quint16 *port)
+{
+    int i = addr.lastIndexOf(':');
+    if (i < 0)
+        return false;
+    bool ok;
+    uint p = addr.mid(i+1).toUInt(&ok);
+    if (!ok || p == 0 || p > 0xffff)
+        return false;
+    *host = addr.left(i);
+    *port = p;
+    return true;
+}
+
+static bool nextLine(QByteArray& buf, QByteArray *line)
+{
+    int n = buf.indexOf('\n');
+    if (n < 0)
+        return false;
+    *line = buf.left(n);
+    buf.remove(0, n+1);
+    return true;
+}
+
+
+RemoteMaster::RemoteMaster()
+    : SearchMaster(nullptr)
+    , cond()
+    , leases()
+    , active()
+    , outbox()
+    , ended()
+    , leasecnt()
+{
+}
+
+void RemoteMaster::preSearch()
+{
+    // the seed list has been prepared by the coordinator
+}
+
+bool RemoteMaster::requestItem(SearchWorker *item)
+{
+    auto it = active.find(item);
+    if (it != active.end())
+    {   // the worker has completed its previous lease
+        if (!stop)
+        {
+            outbox.push_back("DONE " + QByteArray::number((qulonglong)it->second) + "\n");
+            leasecnt++;
+        }
+        active.erase(it);
+        emit outboxReady();
+    }
+
+    while (leases.empty() && !ended && !stop)
+        cond.wait(&mutex, 100);
+
+    if (stop)
+        return false;
+    if (leases.empty())
+    {
+        isdone = true;
+        return false;
+    }
+
+    const SearchLease& l = leases.front();
+    item->prog      = l.prog;
+    item->idx       = l.idx;
+    item->sstart    = l.sstart;
+    item->scnt      = l.scnt;
+    item->seed      = l.seed;
+    active[item] = l.id;
+    leases.pop_front();
+
+    // keep the queue of leases filled
+    outbox.push_back("REQ 1\n");
+    emit outboxReady();
+    return true;
+}
+
+void RemoteMaster::holdResult(uint64_t listidx, uint64_t seed)
+{
+    // the coordinator holds the results instead
+    QMutexLocker locker(&mutex);
+    outbox.push_back("RES " + QByteArray::number((qulonglong)seed) + " " +
+                     QByteArray::number((qulonglong)listidx) + "\n");
+    emit outboxReady();
+}
+
+bool RemoteMaster::listResult(uint64_t listidx, uint64_t seed)
+{
+    // (the list index identifies a result of a list with repeated seeds)
+    holdResult(listidx, seed);
+    return true;
+}
+
+void RemoteMaster::completeItem(uint64_t prog, uint64_t cnt)
+{
+    // the coordinator tracks the completed leases
+    (void) prog;
+    (void) cnt;
+}
+
+
+SearchServer::SearchServer(QString sessionpath, QString resultspath, const HeadlessOpts& opts, QObject *parent)
+    : Headless(sessionpath, resultspath, opts, parent)
+    , addr(opts.serve)
+    , tcpserver()
+    , localserver()
+    , item()
+    , leasetimeout(1000 * (qint64)opts.leasetimeout)
+    , peers()
+    , lent()
+    , reissue()
+    , found()
+    , nextid(1)
+    , lost()
+    , ended()
+{
+    connect(&leasetimer, &QTimer::timeout, this, &SearchServer::checkLeases);
+}
+
+SearchServer::~SearchServer()
+{
+    delete item;
+}
+
+bool SearchServer::listen()
+{
+    QString host;
+    quint16 port;
+    if (parseTcpAddr(addr, &host, &port))
+    {
+        QHostAddress ha (QHostAddress::Any);
+        if (host == "localhost")
+            ha = QHostAddress(QHostAddress::LocalHost);
+        else if (!host.isEmpty() && !ha.setAddress(host))
+        {
+            warn(nullptr, QString("Invalid host address: \"%1\"").arg(host));
+            return false;
+        }
+        tcpserver = new QTcpServer(this);
+        if (!tcpserver->listen(ha, port))
+        {
+            warn(nullptr, QString("Failed to listen on %1:\n%2").arg(addr, tcpserver->errorString()));
+            return false;
+        }
+        connect(tcpserver, &QTcpServer::newConnection, this, &SearchServer::onNewConnection);
+    }
+    else
+    {
+        localserver = new QLocalServer(this);
+        QLocalServer::removeServer(addr); // stale socket of a previous run
+        if (!localserver->listen(addr))
+        {
+            warn(nullptr, QString("Failed to listen on %1:\n%2").arg(addr, localserver->errorString()));
+            return false;
+        }
+        connect(localserver, &QLocalServer::newConnection, this, &SearchServer::onNewConnection);
+    }
+    qOut() << "Waiting for workers on: " << addr << "\n";
+    qOut().flush();
+    return true;
+}
+
+void SearchServer::run()
+{
+    qOut() << "Condition summary:\n";
+    for (const Condition& cond : qAsConst(session.cv))
+        qOut() << cond.summary(false) << "\n";
+
+    if (sthread.isdone)
+    {
+        qOut() << "Search parameters invalid or incomplete.\n";
+        qOut().flush();
+        searchFinish(false);
+        return;
+    }
+    if (stream)
+    {
+        qOut() << "Streamed seed lists are not supported by distributed searches.\n";
+        qOut().flush();
+        searchFinish(false);
+        return;
+    }
+
+    sthread.preSearch();
+    if (!listen())
+    {
+        searchFinish(false);
+        return;
+    }
+
+    if (output.needsHeader())
+        output.writeHeader(session);
+
+    catchSignals();
+    item = new SearchWorker(&sthread);
+    sthread.itemtimer.start();
+    elapsed.start();
+    flushed.start();
+    outtimer.start(100);
+    leasetimer.start(1000);
+    if (!cppath.isEmpty())
+        cptimer.start(1000 * cpinterval);
+
+    if (output.isFile())
+    {
+        qOut() << "\n\n\n\n\n\n\n";
+        qOut().flush();
+        timer.start(250);
+    }
+    checkDone();
+}
+
+void SearchServer::progressTimeout()
+{
+    uint64_t prog, end, seed;
+    {
+        QMutexLocker locker(&sthread.mutex);
+        prog = sthread.isdone ? sthread.scnt : sthread.prog;
+        end = sthread.scnt;
+        seed = sthread.seed;
+    }
+    // the progress is held back by the oldest lease that is not complete
+    for (const auto& it : lent)
+    {
+        if (it.second.lease.prog < prog)
+        {
+            prog = it.second.lease.prog;
+            seed = it.second.lease.sstart;
+        }
+    }
+    for (const SearchLease& l : reissue)
+    {
+        if (l.prog < prog)
+        {
+            prog = l.prog;
+            seed = l.sstart;
+        }
+    }
+    int threads = 0;
+    for (const auto& it : peers)
+        threads += it.second.threads;
+
+    QString status = QString("workers: %1 threads: %2 leases: %3 reissue: %4 lost: %5")
+        .arg(peers.size()).arg(threads).arg(lent.size()).arg(reissue.size()).arg(lost);
+    showProgress(status, prog, end, seed);
+}
+
+void SearchServer::getCheckpoint(uint64_t *seed, Checkpoint *cp)
+{
+    // the outstanding leases hold back the progress, as the items of the
+    // workers do in a local search
+    std::vector<std::pair<uint64_t,uint64_t>> pending;
+    for (const auto& it : lent)
+        pending.emplace_back(it.second.lease.prog, it.second.lease.sstart);
+    for (const SearchLease& l : reissue)
+        pending.emplace_back(l.prog, l.sstart);
+    sthread.getCheckpoint(seed, cp, pending);
+}
+
+void SearchServer::onNewConnection()
+{
+    if (tcpserver)
+    {
+        while (QTcpSocket *sock = tcpserver->nextPendingConnection())
+            addPeer(sock);
+    }
+    if (localserver)
+    {
+        while (QLocalSocket *sock = localserver->nextPendingConnection())
+            addPeer(sock);
+    }
+}
+
+void SearchServer::addPeer(QIODevice *sock)
+{
+    if (ended)
+    {
+        sock->write("END\n");
+        sock->close();
+        return;
+    }
+
+    Peer& peer = peers[sock];
+    peer.seen = elapsed.elapsed();
+    peer.threads = 0;
+    peer.wants = 0;
+
+    connect(sock, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+    connect(sock, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+
+    // the worker gets the session without a shard and with the seed list
+    // already prepared, since the leases determine the search space
+    Session s = session;
+    s.slist.clear();
+    s.slistmap.reset();
+    s.sc.shardidx = 0;
+    s.sc.shardcnt = 1;
+    s.gen48.mode = GEN48_NONE;
+    QByteArray hdr;
+    QTextStream stream(&hdr, QIODevice::WriteOnly);
+    s.writeHeader(stream);
+
+    // (the candidates may be a mapped binary list rather than sthread.slist)
+    const std::vector<uint64_t>& slistidx = sthread.slistidx;
+    sock->write("SESSION " + QByteArray::number(hdr.size()) + "\n");
+    sock->write(hdr);
+    sock->write("LIST " + QByteArray::number((qulonglong)sthread.slen) + " " +
+                QByteArray::number((qulonglong)slistidx.size()) + "\n");
+    sock->write((const char*) sthread.sdata, sthread.slen * sizeof(uint64_t));
+    sock->write((const char*) slistidx.data(), slistidx.size() * sizeof(uint64_t));
+}
+
+void SearchServer::dropPeer(QIODevice *sock)
+{
+    for (auto it = lent.begin(); it != lent.end(); )
+    {
+        if (it->second.peer == sock)
+        {
+            reissue.push_back(it->second.lease);
+            it = lent.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    peers.erase(sock);
+    sock->disconnect(this);
+    sock->close();
+    sock->deleteLater();
+    serve();
+}
+
+void SearchServer::onReadyRead()
+{
+    QIODevice *sock = qobject_cast<QIODevice*>(sender());
+    auto it = peers.find(sock);
+    if (it == peers.end())
+        return;
+    it->second.buf += sock->readAll();
+    it->second.seen = elapsed.elapsed();
+
+    QByteArray line;
+    // (the peer can be dropped while its messages are handled)
+    while (peers.count(sock) && nextLine(peers[sock].buf, &line))
+        handle(sock, line);
+}
+
+void SearchServer::onDisconnected()
+{
+    QIODevice *sock = qobject_cast<QIODevice*>(sender());
+    if (peers.count(sock))
+    {
+        if (!ended)
+            lost++;
+        dropPeer(sock);
+    }
+}
+
+void SearchServer::checkLeases()
+{
+    std::vector<QIODevice*> silent;
+    qint64 now = elapsed.elapsed();
+    for (const auto& it : peers)
+        if (now - it.second.seen > leasetimeout)
+            silent.push_back(it.first);
+    for (QIODevice *sock : silent)
+    {
+        lost++;
+        dropPeer(sock);
+    }
+}
+
+void SearchServer::handle(QIODevice *sock, const QByteArray& line)
+{
+    QList<QByteArray> args = line.trimmed().split(' ');
+    const QByteArray& cmd = args[0];
+    Peer& peer = peers[sock];
+
+    if (cmd == "HELLO" && args.size() == 2)
+    {
+        peer.threads = args[1].toInt();
+    }
+    else if (cmd == "REQ" && args.size() == 2)
+    {
+        peer.wants += args[1].toInt();
+        serve();
+    }
+    else if (cmd == "RES" && args.size() >= 2)
+    {
+        uint64_t seed = args[1].toULongLong();
+        uint64_t key = args.size() >= 3 ? args[2].toULongLong() : seed;
+        if (!found.insert(key).second)
+            return; // already reported under a lease that was reissued
+        if (args.size() >= 3 && !sthread.slistidx.empty())
+            sthread.holdResult(key, seed);
+        else
+            searchResult(seed);
+    }
+    else if (cmd == "DONE" && args.size() == 2)
+    {
+        auto it = lent.find(args[1].toULongLong());
+        // (a late lease may have been reissued to another worker already)
+        if (it != lent.end() && it->second.peer == sock)
+        {   // (for the checkpoints)
+            const SearchLease& l = it->second.lease;
+            sthread.mutex.lock();
+            sthread.completeItem(l.prog, l.scnt);
+            sthread.mutex.unlock();
+            lent.erase(it);
+        }
+        checkDone();
+    }
+    else if (cmd == "PING")
+    {
+    }
+    else
+    {
+        lost++;
+        dropPeer(sock);
+    }
+}
+
+bool SearchServer::nextLease(SearchLease *lease)
+{
+    if (!reissue.empty())
+    {
+        *lease = reissue.front();
+        reissue.pop_front();
+        return true;
+    }
+    QMutexLocker locker(&sthread.mutex);
+    do
+    {   // skip the items that were completed before the search was resumed
+        if (!sthread.requestItem(item))
+            return false;
+    }
+    while (sthread.isCompleted(item->prog, item->scnt));
+    lease->prog     = item->prog;
+    lease->idx      = item->idx;
+    lease->sstart   = item->sstart;
+    lease->scnt     = item->scnt;
+    lease->seed     = item->seed;
+    return true;
+}
+
+void SearchServer::serve()
+{
+    if (ended)
+        return;
+    for (auto& it : peers)
+    {
+        Peer& peer = it.second;
+        while (peer.wants > 0)
+        {
+            SearchLease l;
+            if (!nextLease(&l))
+                break;
+            l.id = nextid++;
+            lent[l.id] = Lent{ l, it.first };
+            peer.wants--;
+            QByteArray msg = "LEASE";
+            msg += " " + QByteArray::number((qulonglong)l.id);
+            msg += " " + QByteArray::number((qulonglong)l.prog);
+            msg += " " + QByteArray::number((qulonglong)l.idx);
+            msg += " " + QByteArray::number((qulonglong)l.sstart);
+            msg += " " + QByteArray::number(l.scnt);
+            msg += " " + QByteArray::number((qulonglong)l.seed);
+            msg += "\n";
+            it.first->write(msg);
+        }
+    }
+}
+
+void SearchServer::checkDone()
+{
+    if (ended || !sthread.isdone || !lent.empty() || !reissue.empty())
+        return;
+    ended = true;
+    leasetimer.stop();
+    for (const auto& it : peers)
+    {
+        it.first->write("END\n");
+        it.first->waitForBytesWritten(1000);
+    }
+    sthread.mutex.lock();
+    sthread.releaseHeldResults();
+    sthread.mutex.unlock();
+    // (finish after the queued release of the held results)
+    QMetaObject::invokeMethod(this, "searchFinish", Qt::QueuedConnection, Q_ARG(bool, true));
+}
+
+
+SearchClient::SearchClient(const HeadlessOpts& opts, QObject *parent)
+    : QObject(parent)
+    , addr(opts.connect)
+    , sock()
+    , sthread()
+    , session()
+    , buf()
+    , blocktype(BLOCK_NONE)
+    , blocklen()
+    , listlen()
+    , threads(QThread::idealThreadCount())
+    , rescnt()
+    , ended()
+{
+    QSettings settings(APP_STRING, APP_STRING);
+    g_extgen.load(settings);
+    g_luabudget = settings.value("config/luaBudget", g_luabudget).toInt();
+    g_luaprofiling = settings.value("config/luaProfile", g_luaprofiling).toBool();
+
+    if (threads < 1)
+        threads = 1;
+
+    connect(&sthread, &SearchMaster::searchResult, this, &SearchClient::onResult, Qt::QueuedConnection);
+    connect(&sthread, &SearchMaster::searchFinish, this, &SearchClient::onFinish, Qt::QueuedConnection);
+    connect(&sthread, &RemoteMaster::outboxReady, this, &SearchClient::flushOutbox, Qt::QueuedConnection);
+    connect(&pingtimer, &QTimer::timeout, this, &SearchClient::ping);
+}
+
+SearchClient::~SearchClient()
+{
+}
+
+void SearchClient::run()
+{
+    QString host;
+    quint16 port;
+    if (parseTcpAddr(addr, &host, &port))
+    {
+        QTcpSocket *tcp = new QTcpSocket(this);
+        tcp->connectToHost(host.isEmpty() ? QString("localhost") : host, port);
+        sock = tcp;
+    }
+    else
+    {
+        QLocalSocket *local = new QLocalSocket(this);
+        local->connectToServer(addr);
+        sock = local;
+    }
+
+    bool ok;
+    if (QTcpSocket *tcp = qobject_cast<QTcpSocket*>(sock))
+        ok = tcp->waitForConnected(10000);
+    else
+        ok = qobject_cast<QLocalSocket*>(sock)->waitForConnected(10000);
+    if (!ok)
+    {
+        abort(QString("Failed to connect to coordinator at %1:\n%2").arg(addr, sock->errorString()));
+        return;
+    }
+
+    qOut() << "Connected to coordinator at: " << addr << "\n";
+    qOut().flush();
+
+    connect(sock, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+    connect(sock, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+    sock->write("HELLO " + QByteArray::number(threads) + "\n");
+    pingtimer.start(1000 * PING_INTERVAL);
+    onReadyRead();
+}
+
+void SearchClient::onReadyRead()
+{
+    buf += sock->readAll();
+    while (!ended)
+    {
+        if (blocktype != BLOCK_NONE)
+        {
+            if (buf.size() < blocklen)
+                return;
+            QByteArray block = buf.left(blocklen);
+            buf.remove(0, blocklen);
+            if (!handleBlock(block))
+                return;
+            continue;
+        }
+        QByteArray line;
+        if (!nextLine(buf, &line))
+            return;
+        if (!handleLine(line))
+        {
+            abort(QString("Unexpected message from coordinator: %1").arg(QString(line)));
+            return;
+        }
+    }
+}
+
+bool SearchClient::handleLine(const QByteArray& line)
+{
+    QList<QByteArray> args = line.trimmed().split(' ');
+    const QByteArray& cmd = args[0];
+
+    if (cmd == "SESSION" && args.size() == 2)
+    {
+        blocktype = BLOCK_SESSION;
+        blocklen = args[1].toLongLong();
+    }
+    else if (cmd == "LIST" && args.size() == 3)
+    {
+        listlen = args[1].toULongLong();
+        blocktype = BLOCK_LIST;
+        blocklen = (listlen + args[2].toULongLong()) * sizeof(uint64_t);
+    }
+    else if (cmd == "LEASE" && args.size() == 7)
+    {
+        SearchLease l;
+        l.id        = args[1].toULongLong();
+        l.prog      = args[2].toULongLong();
+        l.idx       = args[3].toULongLong();
+        l.sstart    = args[4].toULongLong();
+        l.scnt      = args[5].toInt();
+        l.seed      = args[6].toULongLong();
+        QMutexLocker locker(&sthread.mutex);
+        sthread.leases.push_back(l);
+        sthread.cond.wakeOne();
+    }
+    else if (cmd == "END")
+    {
+        QMutexLocker locker(&sthread.mutex);
+        sthread.ended = true;
+        sthread.cond.wakeAll();
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool SearchClient::handleBlock(const QByteArray& block)
+{
+    int type = blocktype;
+    blocktype = BLOCK_NONE;
+    blocklen = 0;
+
+    if (type == BLOCK_SESSION)
+    {
+        QTextStream stream(block);
+        if (!session.load(nullptr, stream, true))
+        {
+            abort("Failed to read the session of the coordinator.");
+            return false;
+        }
+        return true;
+    }
+
+    const uint64_t *p = (const uint64_t*) block.constData();
+    uint64_t n = block.size() / sizeof(uint64_t);
+    session.slist.assign(p, p + listlen);
+    sthread.slistidx.assign(p + listlen, p + n);
+    return startWorkers();
+}
+
+bool SearchClient::startWorkers()
+{
+    std::vector<uint64_t> slistidx;
+    slistidx.swap(sthread.slistidx);
+    session.sc.threads = threads;
+    if (!sthread.set(nullptr, session))
+    {
+        abort("Search parameters of the coordinator are invalid or not supported.");
+        return false;
+    }
+    sthread.slistidx.swap(slistidx);
+
+    qOut() << "Condition summary:\n";
+    for (const Condition& cond : qAsConst(session.cv))
+        qOut() << cond.summary(false) << "\n";
+    qOut() << "\nSearching for seeds with " << threads << " threads...\n";
+    qOut().flush();
+
+    sthread.startSearch();
+    sock->write("REQ " + QByteArray::number(2 * threads) + "\n");
+    return true;
+}
+
+void SearchClient::onDisconnected()
+{
+    if (!ended)
+        abort("Connection to the coordinator was lost.");
+}
+
+void SearchClient::onResult(uint64_t seed)
+{
+    rescnt++;
+    sock->write("RES " + QByteArray::number((qulonglong)seed) + "\n");
+}
+
+void SearchClient::onFinish(bool done)
+{
+    if (ended)
+        return;
+    flushOutbox();
+    ended = true;
+    pingtimer.stop();
+    if (sock)
+    {
+        sock->waitForBytesWritten(1000);
+        sock->disconnect(this);
+        sock->close();
+    }
+    qOut() << (done ? "Search done!\n" : "Search stopped.\n");
+    qOut() << "Completed leases: " << sthread.leasecnt << ", matching seeds: " << rescnt << "\n";
+    qOut().flush();
+    emit finished();
+}
+
+void SearchClient::flushOutbox()
+{
+    std::vector<QByteArray> msgs;
+    sthread.mutex.lock();
+    msgs.swap(sthread.outbox);
+    sthread.mutex.unlock();
+    if (!sock || ended)
+        return;
+    for (const QByteArray& msg : msgs)
+    {
+        if (msg.startsWith("RES"))
+            rescnt++;
+        sock->write(msg);
+    }
+}
+
+void SearchClient::ping()
+{
+    sock->write("PING\n");
+}
+
+void SearchClient::abort(const QString& msg)
+{
+    warn(nullptr, msg);
+    if (sthread.workers.empty())
+    {   // no search is running that would finish
+        ended = true;
+        emit finished();
+    }
+    else
+    {
+        sthread.stopSearch(); // finishes the search via onFinish()
+    }
+}
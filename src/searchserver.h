@@ -0,0 +1,154 @@
+#ifndef SEARCHSERVER_H
+#define SEARCHSERVER_H
+
+#include "headless.h"
+
+#include <QWaitCondition>
+
+#include <deque>
+#include <map>
+#include <unordered_set>
+
+class QLocalServer;
+class QTcpServer;
+
+// A work item of the search master that is lent out to a remote worker.
+struct SearchLease
+{
+    uint64_t id;
+    uint64_t prog, idx, sstart, seed;
+    int scnt;
+};
+
+// Search master of a remote worker that processes the leases it receives
+// from a coordinator, rather than dividing the search space itself.
+struct RemoteMaster : SearchMaster
+{
+    Q_OBJECT
+public:
+    RemoteMaster();
+
+    virtual void preSearch() override;
+    virtual bool requestItem(SearchWorker *item) override;
+    virtual void holdResult(uint64_t listidx, uint64_t seed) override;
+    virtual bool listResult(uint64_t listidx, uint64_t seed) override;
+    virtual void completeItem(uint64_t prog, uint64_t cnt) override;
+
+signals:
+    void outboxReady();
+
+public:
+    QWaitCondition              cond;       // signals new leases
+    std::deque<SearchLease>     leases;     // received leases
+    std::map<SearchWorker*, uint64_t> active; // lease ids being processed
+    std::vector<QByteArray>     outbox;     // messages for the coordinator
+    bool                        ended;      // coordinator has no more leases
+    uint64_t                    leasecnt;   // number of completed leases
+};
+
+// Coordinator of a distributed search. It owns the work queue of the
+// session and hands out leases on the search items to the workers that
+// connect over TCP (host:port) or a local socket (name or path). The leases
+// of a worker that disconnects, or stays silent for longer than the lease
+// timeout, are reissued to the other workers.
+class SearchServer : public Headless
+{
+    Q_OBJECT
+
+public:
+    SearchServer(QString sessionpath, QString resultspath, const HeadlessOpts& opts, QObject *parent = 0);
+    virtual ~SearchServer();
+
+    bool listen();
+
+public slots:
+    void run();
+    virtual void progressTimeout() override;
+    virtual void getCheckpoint(uint64_t *seed, Checkpoint *cp) override;
+    void onNewConnection();
+    void onReadyRead();
+    void onDisconnected();
+    void checkLeases();
+
+private:
+    struct Peer
+    {
+        QByteArray buf;     // received data of incomplete lines
+        qint64 seen;        // time of the last message
+        int threads;
+        int wants;          // number of requested leases
+    };
+    struct Lent
+    {
+        SearchLease lease;
+        QIODevice *peer;
+    };
+
+    void addPeer(QIODevice *sock);
+    void dropPeer(QIODevice *sock);
+    void handle(QIODevice *sock, const QByteArray& line);
+    bool nextLease(SearchLease *lease);
+    void serve();
+    void checkDone();
+
+public:
+    QString addr;
+    QTcpServer *tcpserver;
+    QLocalServer *localserver;
+    SearchWorker *item;     // receives the items of the search master
+    qint64 leasetimeout;    // in msec
+    std::map<QIODevice*, Peer> peers;
+    std::map<uint64_t, Lent> lent;
+    std::deque<SearchLease> reissue;
+    std::unordered_set<uint64_t> found; // seeds, or list positions of a list
+    uint64_t nextid;
+    int lost;               // number of workers that were dropped
+    bool ended;
+    QTimer leasetimer;
+};
+
+// Worker of a distributed search: receives the session from a coordinator
+// and processes the leases it is given with local search threads, while
+// streaming back the results and completed leases.
+class SearchClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    SearchClient(const HeadlessOpts& opts, QObject *parent = 0);
+    virtual ~SearchClient();
+
+public slots:
+    void run();
+    void onReadyRead();
+    void onDisconnected();
+    void onResult(uint64_t seed);
+    void onFinish(bool done);
+    void flushOutbox();
+    void ping();
+
+signals:
+    void finished();
+
+private:
+    bool handleLine(const QByteArray& line);
+    bool handleBlock(const QByteArray& block);
+    bool startWorkers();
+    void abort(const QString& msg);
+
+public:
+    QString addr;
+    QIODevice *sock;
+    RemoteMaster sthread;
+    Session session;
+    QByteArray buf;
+    int blocktype;          // type of the binary block that is being received
+    qint64 blocklen;        // size of that block
+    uint64_t listlen;       // number of candidates in the list block
+    int threads;
+    uint64_t rescnt;
+    bool ended;
+    QTimer pingtimer;
+};
+
+#endif // SEARCHSERVER_H
@@ -3,7 +3,10 @@
 #include "aboutdialog.h"
 #include "formsearchcontrol.h"
 #include "message.h"
+#include "scripts.h"
 #include "seedtables.h"
+#include "seedstream.h"
+#include "workerpolicy.h"
 
 #include "cubiomes/quadbase.h"
 #include "cubiomes/util.h"
@@ -12,10 +15,16 @@
 #include <QDateTime>
 #include <QElapsedTimer>
 #include <QEventLoop>
+#include <QFile>
 #include <QMutex>
 #include <QDirIterator>
 #include <QVector>
 
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <thread>
+
 
 void Session::writeHeader(QTextStream& stream)
 {
@@ -70,57 +79,96 @@ bool Session::load(QWidget *widget, QTextStream& stream, bool quiet)
             return false;
     }
 
-    while (stream.status() == QTextStream::Ok && !stream.atEnd())
+    // reads a line that is not a seed, returns false to stop loading
+    auto readLine = [&](const QString& line, uint64_t lno) -> bool
     {
-        lno++;
-        line = stream.readLine();
-
-        if (line.isEmpty()) continue;
-        if (line.startsWith("#Time:")) continue;
-        if (line.startsWith("#Title:")) continue;
-        if (line.startsWith("#Desc:")) continue;
-        if (sc.read(line)) continue;
-        if (gen48.read(line)) continue;
-        if (wi.read(line)) continue;
-
+        if (line.startsWith("#Time:")) return true;
+        if (line.startsWith("#Title:")) return true;
+        if (line.startsWith("#Desc:")) return true;
+        if (sc.read(line)) return true;
+        if (cp.read(line)) return true;
+        if (gen48.read(line)) return true;
+        if (wi.read(line)) return true;
+
+        int button;
         if (line.startsWith("#Cond:"))
         {   // Conditions
             Condition c;
             if (c.readHex(line.mid(6).trimmed()))
             {
                 cv.push_back(c);
+                return true;
             }
-            else
-            {
-                if (quiet)
-                    return false;
-                int button = warn(widget, QApplication::tr("Warning"),
-                    QApplication::tr("Condition [%1] at line %2 is not supported.").arg(c.save).arg(lno),
-                    QApplication::tr("Continue anyway?"), QMessageBox::Abort | QMessageBox::Yes);
-                if (button != QMessageBox::Yes)
-                    return false;
-            }
+            if (quiet)
+                return false;
+            button = warn(widget, QApplication::tr("Warning"),
+                QApplication::tr("Condition [%1] at line %2 is not supported.").arg(c.save).arg(lno),
+                QApplication::tr("Continue anyway?"), QMessageBox::Abort | QMessageBox::Yes);
         }
         else
-        {   // Seeds
-            QByteArray ba = line.toLocal8Bit();
-            const char *p = ba.data();
-            uint64_t s;
-            if (sscanf(p, "%" PRId64, (int64_t*)&s) == 1)
+        {
+            if (quiet)
+                return false;
+            button = warn(widget, QApplication::tr("Warning"),
+                QApplication::tr("Failed to parse line %1 of file:\n%2").arg(lno).arg(line),
+                QApplication::tr("Continue anyway?"), QMessageBox::Abort | QMessageBox::Yes);
+        }
+        return button == QMessageBox::Yes;
+    };
+
+    // the seeds of a session file are parsed in bulk from the mapped file
+    QFile *file = qobject_cast<QFile*>(stream.device());
+    if (file && file->isSequential())
+        file = nullptr;
+
+    while (stream.status() == QTextStream::Ok && !stream.atEnd())
+    {
+        lno++;
+        line = stream.readLine();
+
+        if (line.isEmpty())
+            continue;
+        if (line.startsWith("#"))
+        {
+            if (!readLine(line, lno))
+                return false;
+            continue;
+        }
+
+        uchar *map = file ? file->map(0, file->size()) : nullptr;
+        if (map)
+        {   // parse the rest of the file from the start of this line
+            const char *text = (const char*) map;
+            size_t size = file->size(), pos = 0;
+            for (int i = 1; i < lno && pos < size; i++)
             {
-                slist.push_back(s);
+                const char *nl = (const char*) memchr(text + pos, '\n', size - pos);
+                pos = nl ? nl - text + 1 : size;
             }
-            else
+            std::vector<SeedTextLine> others;
+            parseSeedText(text + pos, size - pos, lno, slist, &others);
+            // the remaining lines are read as before
+            bool ok = true;
+            for (const SeedTextLine& o : others)
             {
-                if (quiet)
-                    return false;
-                int button = warn(widget, QApplication::tr("Warning"),
-                    QApplication::tr("Failed to parse line %1 of file:\n%2").arg(lno).arg(line),
-                    QApplication::tr("Continue anyway?"), QMessageBox::Abort | QMessageBox::Yes);
-                if (button != QMessageBox::Yes)
-                    return false;
+                QString l = QString::fromUtf8(text + pos + o.pos, o.len);
+                if (l.endsWith('\r'))
+                    l.chop(1);
+                if (!(ok = readLine(l, o.lineno)))
+                    break;
             }
+            file->unmap(map);
+            return ok;
         }
+
+        // Seeds
+        QByteArray ba = line.toLocal8Bit();
+        const char *p = ba.data();
+        uint64_t s;
+        if (sscanf(p, "%" PRId64, (int64_t*)&s) == 1)
+            slist.push_back(s);
+        else if (!readLine(line, lno))
+            return false;
     }
     return true;
 }
@@ -142,7 +190,17 @@ SearchMaster::SearchMaster(QWidget *parent)
     , itemsize()
     , threadcnt()
     , gen48()
+    , listorder()
+    , shardidx()
+    , shardcnt(1)
     , slist()
+    , slistidx()
+    , slistmap()
+    , stream()
+    , sdata()
+    , slen()
+    , held()
+    , completed()
     , idx()
     , scnt()
     , prog()
@@ -150,8 +208,22 @@ SearchMaster::SearchMaster(QWidget *parent)
     , smin()
     , smax()
     , isdone()
+    , reseeds()
+    , condstats()
+    , autothreads()
+    , threadlimit(INT_MAX)
+    , parkcond()
+    , tunetimer()
+    , tuneclock()
+    , tunecnt()
+    , tunerate()
+    , tunestep(-1)
+    , tunemeasure()
+    , tuneprog()
 {
     env.stop = &stop;
+    tunetimer.setSingleShot(true);
+    connect(&tunetimer, &QTimer::timeout, this, &SearchMaster::onTuneTimer);
 }
 
 SearchMaster::~SearchMaster()
@@ -289,6 +361,12 @@ bool SearchMaster::set(QWidget *widget, const Session& s)
         }
     }
 
+    if (s.sc.shardcnt < 1 || s.sc.shardidx < 0 || s.sc.shardidx >= s.sc.shardcnt)
+    {
+        warn(widget, tr("Invalid search shard %1/%2.").arg(s.sc.shardidx).arg(s.sc.shardcnt));
+        return false;
+    }
+
     QString err = condtree.set(s.cv, s.wi.mc);
     if (err.isEmpty())
     {
@@ -300,13 +378,52 @@ bool SearchMaster::set(QWidget *widget, const Session& s)
         return false;
     }
 
+    if (s.gen48.mode == GEN48_SOLVE && s.sc.searchtype != SEARCH_LIST)
+    {
+        std::vector<PinnedStruct> pins;
+        if (getPinnedStructs(pins, condtree.condvec, s.wi.mc) == 0)
+        {
+            warn(widget, tr("The 48-bit solver requires a structure condition that "
+                            "confines its structure to a single region."));
+            return false;
+        }
+        if (estimatePinned48(pins) * sizeof(uint64_t) >= PRECOMPUTE48_BUFSIZ)
+        {
+            int button = warn(widget, tr("Warning"),
+                tr("The pinned structure positions are not restrictive enough "
+                   "for the 48-bit solver, and all 48-bit seeds will be checked."),
+                tr("Continue anyway?"), QMessageBox::Abort | QMessageBox::Yes);
+            if (button != QMessageBox::Yes)
+                return false;
+        }
+    }
+
     this->searchtype = s.sc.searchtype;
     this->mc = s.wi.mc;
     this->large = s.wi.large;
     this->itemsize = 1;
-    this->threadcnt = s.sc.threads;
+    this->autothreads = s.sc.threads <= 0;
+    this->threadcnt = autothreads ? QThread::idealThreadCount() : s.sc.threads;
+    if (this->threadcnt < 1)
+        this->threadcnt = 1;
     this->slist = s.slist;
+    this->slistmap = s.slistmap;
+    if (slistmap && (searchtype != SEARCH_LIST || s.sc.listorder != LIST_ORDER_FILE))
+    {   // the list is reordered in a copy
+        this->slist.assign(slistmap->data(), slistmap->data() + slistmap->size());
+        this->slistmap.reset();
+    }
+    this->slistidx.clear();
+    // (for masters, like a remote one, that do not run the default preSearch)
+    setListView();
+    this->held = s.cp.held;
+    this->completed.clear();
+    for (const auto& r : s.cp.ranges)
+        completeItem(r.first, r.second - r.first);
     this->gen48 = s.gen48;
+    this->listorder = s.sc.listorder;
+    this->shardidx = s.sc.shardidx;
+    this->shardcnt = s.sc.shardcnt;
     this->idx = 0;
     this->scnt = ~(uint64_t)0;
     this->prog = 0;
@@ -315,6 +432,7 @@ bool SearchMaster::set(QWidget *widget, const Session& s)
     this->smax = s.sc.smax;
     this->isdone = false;
     this->stop = false;
+    this->condstats.assign(condtree.condvec.size(), SearchThreadEnv::CondStats());
     return true;
 }
 
@@ -394,6 +512,76 @@ static bool applyTranspose(std::vector<uint64_t>& slist,
     return !slist.empty();
 }
 
+// Stable sort using multiple threads: sorts blocks independently and then
+// merges neighbouring blocks (which preserves the order of equal elements).
+template <class T, class Cmp>
+static void parallelStableSort(std::vector<T>& v, Cmp cmp, int threads)
+{
+    size_t n = v.size();
+    if (threads < 2 || n < 0x10000)
+    {
+        std::stable_sort(v.begin(), v.end(), cmp);
+        return;
+    }
+    std::vector<size_t> bounds;
+    for (int t = 0; t <= threads; t++)
+        bounds.push_back(n * t / threads);
+
+    std::vector<std::thread> tv;
+    for (int t = 0; t < threads; t++)
+    {
+        size_t a = bounds[t], b = bounds[t+1];
+        tv.emplace_back([&v, a, b, cmp]() {
+            std::stable_sort(v.begin() + a, v.begin() + b, cmp);
+        });
+    }
+    for (std::thread& th : tv)
+        th.join();
+
+    for (int w = 1; w < threads; w *= 2)
+    {
+        tv.clear();
+        for (int t = 0; t + w < threads; t += 2*w)
+        {
+            size_t a = bounds[t], m = bounds[t+w];
+            size_t b = bounds[t+2*w < threads ? t+2*w : threads];
+            tv.emplace_back([&v, a, m, b, cmp]() {
+                std::inplace_merge(v.begin() + a, v.begin() + m, v.begin() + b, cmp);
+            });
+        }
+        for (std::thread& th : tv)
+            th.join();
+    }
+}
+
+// Groups a 64-bit seed list by the lower 48 bits (keeping the list order
+// within each group), so that seeds which share the 48-bit state of the
+// generators and structures are processed back-to-back. Optionally returns
+// the original list index of each seed.
+static void groupByLower48(std::vector<uint64_t>& slist,
+        std::vector<uint64_t> *origidx, int threads)
+{
+    if (!origidx)
+    {
+        parallelStableSort(slist, [](uint64_t a, uint64_t b) {
+            return (a & MASK48) < (b & MASK48);
+        }, threads);
+        return;
+    }
+    std::vector<uint64_t>& perm = *origidx;
+    perm.resize(slist.size());
+    for (size_t i = 0; i < perm.size(); i++)
+        perm[i] = i;
+    const uint64_t *s = slist.data();
+    parallelStableSort(perm, [s](uint64_t a, uint64_t b) {
+        return (s[a] & MASK48) < (s[b] & MASK48);
+    }, threads);
+    std::vector<uint64_t> sorted(slist.size());
+    for (size_t i = 0; i < perm.size(); i++)
+        sorted[i] = slist[perm[i]];
+    slist.swap(sorted);
+}
+
 void SearchMaster::preSearch()
 {
     uint64_t sstart = seed;
@@ -448,23 +636,65 @@ void SearchMaster::preSearch()
                     rs += gen48.listsalt;
             }
         }
+        else if (gen48.mode == GEN48_SOLVE)
+        {
+            std::vector<PinnedStruct> pins;
+            getPinnedStructs(pins, condtree.condvec, mc);
+            // falls back to a full 48-bit search if the positions are not
+            // restrictive enough to be solved for
+            if (solvePinned48(slist, pins, mc, threadcnt, PRECOMPUTE48_BUFSIZ, &stop))
+            {
+                if (slist.empty())
+                    isdone = true; // no seed can satisfy the conditions
+            }
+        }
 
-        if (!slist.empty())
+        // the solver yields absolute positions that are not transposed
+        if (!slist.empty() && gen48.mode != GEN48_SOLVE)
             applyTranspose(slist, gen48, PRECOMPUTE48_BUFSIZ);
     }
 
     if (searchtype == SEARCH_LIST)
     {
-        if (!slist.empty())
+        slistidx.clear();
+        if (listorder == LIST_ORDER_GROUP48)
+            groupByLower48(slist, NULL, threadcnt);
+        else if (listorder == LIST_ORDER_GROUP48_REPORT)
+            groupByLower48(slist, &slistidx, threadcnt);
+    }
+
+    setListView();
+
+    if (searchtype == SEARCH_LIST)
+    {
+        if (stream)
+        {   // the size of a streamed list is known at its end
+            scnt = 0;
+            prog = idx = 0;
+            seed = sstart;
+            smax = ~(uint64_t)0;
+        }
+        else if (slen)
         {   // 64-bit seed list
-            scnt = slist.size();
-            for (idx = 0; idx < scnt; idx++)
-                if (slist[idx] == sstart)
-                    break;
+            scnt = slen;
+            if (slistmap && slistmap->isSorted())
+            {   // (rather than paging in the list up to the start)
+                idx = std::lower_bound(sdata, sdata + slen, sstart, [](uint64_t a, uint64_t b) {
+                    return (int64_t) a < (int64_t) b;
+                }) - sdata;
+                if (idx < scnt && sdata[idx] != sstart)
+                    idx = scnt;
+            }
+            else
+            {
+                for (idx = 0; idx < scnt; idx++)
+                    if (sdata[idx] == sstart)
+                        break;
+            }
             if (idx == scnt)
                 idx = 0;
-            seed = slist[idx];
-            smax = slist.back();
+            seed = sdata[idx];
+            smax = sdata[slen-1];
             prog = idx;
         }
         else
@@ -477,16 +707,16 @@ void SearchMaster::preSearch()
 
     if (searchtype == SEARCH_48ONLY)
     {
-        if (!slist.empty())
+        if (slen)
         {   // 48-bit seed list
-            scnt = slist.size();
+            scnt = slen;
             for (idx = 0; idx < scnt; idx++)
-                if (slist[idx] == sstart)
+                if (sdata[idx] == sstart)
                     break;
             if (idx == scnt)
                 idx = 0;
-            seed = slist[idx];
-            smax = slist.back();
+            seed = sdata[idx];
+            smax = sdata[slen-1];
             prog = idx;
         }
         else
@@ -500,35 +730,35 @@ void SearchMaster::preSearch()
 
     if (searchtype == SEARCH_INC)
     {   // smin & smax are given by user
-        if (!slist.empty())
+        if (slen)
         {   // incremental search with a 48-bit list (incl. quad-searches)
             seed = sstart;
             if (seed < smin)
                 seed = smin;
-            scnt = 0x10000 * slist.size();
+            scnt = 0x10000 * slen;
             uint64_t high = (seed >> 48) & 0xffff;
-            for (idx = 0; idx < slist.size(); idx++)
-                if (slist[idx] >= (seed & MASK48))
+            for (idx = 0; idx < slen; idx++)
+                if (sdata[idx] >= (seed & MASK48))
                     break;
-            if (idx == slist.size())
+            if (idx == slen)
             {
                 if (high++ >= (smax >> 48))
                     isdone = true;
                 idx = 0;
             }
-            seed = (high << 48) | slist[idx];
+            seed = (high << 48) | sdata[idx];
             // trim the search space to the range [smin, smax]
             uint64_t idxmin, idxmax;
-            for (idxmin = 0; idxmin < slist.size(); idxmin++)
-                if (slist[idxmin] >= (smin & MASK48))
+            for (idxmin = 0; idxmin < slen; idxmin++)
+                if (sdata[idxmin] >= (smin & MASK48))
                     break;
-            for (idxmax = 0; idxmax < slist.size(); idxmax++)
-                if (slist[idxmax] >= (smax & MASK48))
+            for (idxmax = 0; idxmax < slen; idxmax++)
+                if (sdata[idxmax] >= (smax & MASK48))
                     break;
             high = (high - (smin >> 48)) & 0xffff;
-            prog = high * slist.size() + idx - idxmin;
+            prog = high * slen + idx - idxmin;
             high = ((smax >> 48) - (smin >> 48)) & 0xffff;
-            scnt = high * slist.size() + idxmax - idxmin;
+            scnt = high * slen + idxmax - idxmin;
         }
         else
         {   // simple incremental search
@@ -544,20 +774,20 @@ void SearchMaster::preSearch()
 
     if (searchtype == SEARCH_BLOCKS)
     {
-        if (!slist.empty())
+        if (slen)
         {
-            scnt = 0x10000 * slist.size();
-            for (idx = 0; idx < slist.size(); idx++)
-                if (slist[idx] >= (sstart & MASK48))
+            scnt = 0x10000 * slen;
+            for (idx = 0; idx < slen; idx++)
+                if (sdata[idx] >= (sstart & MASK48))
                     break;
-            if (idx == slist.size())
+            if (idx == slen)
                 isdone = true;
             else
             {
-                seed = (sstart & ~MASK48) | slist[idx];
+                seed = (sstart & ~MASK48) | sdata[idx];
                 prog = 0x10000 * idx + (seed >> 48);
             }
-            smax = slist.back() | (0xffffULL << 48);
+            smax = sdata[slen-1] | (0xffffULL << 48);
         }
         else
         {
@@ -568,6 +798,21 @@ void SearchMaster::preSearch()
     }
 }
 
+void SearchMaster::setListView()
+{
+    // the candidates are read from the mapped file of a binary list, or slist
+    if (slistmap)
+    {
+        sdata = slistmap->data();
+        slen = slistmap->size();
+    }
+    else
+    {
+        sdata = slist.empty() ? NULL : slist.data();
+        slen = slist.size();
+    }
+}
+
 void SearchMaster::startSearch()
 {
     stopSearch();
@@ -581,26 +826,38 @@ void SearchMaster::startSearch()
     }
 
     for (int i = 0; i < threadcnt; i++)
-    {
-        SearchWorker *worker = new SearchWorker(this);
-        QObject::connect(
-            worker, &SearchWorker::result,
-            this, &SearchMaster::onWorkerResult,
-            Qt::BlockingQueuedConnection);
-        QObject::connect(
-            worker, &SearchWorker::finished,
-            this, &SearchMaster::onWorkerFinished,
-            Qt::QueuedConnection);
-
-        workers.push_back(worker);
-    }
+        workers.push_back(newWorker());
 
     QMutexLocker locker(&mutex);
 
+    threadlimit = INT_MAX;
+    tunestep = -1;
+    if (autothreads && threadcnt > 1)
+    {   // probe from all workers down to one per core on SMT machines
+        tunecnt.clear();
+        int n[] = { threadcnt, (3 * threadcnt + 3) / 4, (threadcnt + 1) / 2 };
+        for (int c : n)
+            if (std::find(tunecnt.begin(), tunecnt.end(), c) == tunecnt.end())
+                tunecnt.push_back(c);
+        tunerate.assign(tunecnt.size(), 0);
+        tunestep = 0;
+        tunemeasure = false;
+        setThreadLimit(tunecnt[0]);
+        tunetimer.start(TUNE_SETTLE_MS);
+    }
+
     proghist.clear();
     progtimer.start();
     itemtimer.start();
     count = 0;
+    memset(&reseeds, 0, sizeof(reseeds));
+    condstats.assign(condtree.condvec.size(), SearchThreadEnv::CondStats());
+    if (g_luaprofiling)
+    {
+        for (const Condition& c : condtree.condvec)
+            if (c.type == F_LUA)
+                g_lua_profile[c.save].clear();
+    }
 
     for (SearchWorker *worker : workers)
     {
@@ -608,9 +865,49 @@ void SearchMaster::startSearch()
     }
 }
 
+SearchWorker *SearchMaster::newWorker()
+{
+    SearchWorker *worker = new SearchWorker(this);
+    worker->num = (int) workers.size();
+    QObject::connect(
+        worker, &SearchWorker::result,
+        this, &SearchMaster::onWorkerResult,
+        Qt::BlockingQueuedConnection);
+    QObject::connect(
+        worker, &SearchWorker::finished,
+        this, &SearchMaster::onWorkerFinished,
+        Qt::QueuedConnection);
+    return worker;
+}
+
+int SearchMaster::addWorkers(int n)
+{
+    QMutexLocker locker(&mutex);
+    if (workers.empty() || isdone || stop)
+        return 0;
+    for (int i = 0; i < n; i++)
+    {
+        SearchWorker *worker = newWorker();
+        workers.push_back(worker);
+        worker->start();
+    }
+    threadcnt += n;
+    return n;
+}
+
+int SearchMaster::activeWorkers()
+{
+    int n = 0;
+    for (SearchWorker *worker : workers)
+        n += !worker->isFinished();
+    return n;
+}
+
 void SearchMaster::stopSearch()
 {
     stop = true;
+    tunetimer.stop();
+    parkcond.wakeAll();
     if (workers.empty())
         return;
 
@@ -638,6 +935,10 @@ void SearchMaster::stopSearch()
     }
     workers.clear();
 
+    mutex.lock();
+    releaseHeldResults();
+    mutex.unlock();
+
     emit searchFinish(false);
 }
 
@@ -657,7 +958,7 @@ bool SearchMaster::getProgress(QString *status, uint64_t *prog, uint64_t *end, u
 {
     if (!mutex.tryLock(10))
     {
-        if (searchtype == SEARCH_BLOCKS && slist.empty())
+        if (searchtype == SEARCH_BLOCKS && !slen)
         {   // a block search with no list looks for candidates in the search
             // master and can therefore make progress outside of workers
             *prog = this->prog;
@@ -675,6 +976,8 @@ bool SearchMaster::getProgress(QString *status, uint64_t *prog, uint64_t *end, u
     bool valid = false;
     for (SearchWorker *worker: workers)
     {
+        if (worker->parked)
+            continue;
         if (worker->prog < *prog)
         {
             *prog = worker->prog;
@@ -687,6 +990,7 @@ bool SearchMaster::getProgress(QString *status, uint64_t *prog, uint64_t *end, u
     {
         *prog = this->scnt;
     }
+    int active = std::min(threadlimit, (int) workers.size());
 
     mutex.unlock();
 
@@ -761,14 +1065,126 @@ bool SearchMaster::getProgress(QString *status, uint64_t *prog, uint64_t *end, u
         .arg(getAbbrNum(*max), -8)
         .arg(itemsize, -3)
         .arg(eta);
+    if (autothreads && !workers.empty())
+        *status += QString(" threads: %1").arg(active);
 
     return valid;
 }
 
+void SearchMaster::applyShard(uint64_t *isize)
+{
+    // position of the current candidate in units of the shard blocks
+    uint64_t pos, bsiz = SHARD_BLOCK;
+    uint64_t len = slen;
+    switch (searchtype)
+    {
+    case SEARCH_LIST:
+        pos = idx;
+        break;
+    case SEARCH_48ONLY:
+        pos = len ? idx : seed;
+        break;
+    case SEARCH_INC:
+        pos = len ? ((seed >> 48) & 0xffff) * len + idx : seed;
+        break;
+    case SEARCH_BLOCKS:
+        pos = len ? idx : (seed & MASK48);
+        bsiz = SHARD_BLOCK48;
+        break;
+    default:
+        return;
+    }
+
+    uint64_t blk = pos / bsiz;
+    uint64_t own = blk - blk % shardcnt + shardidx;
+    if (own < blk)
+        own += shardcnt;
+    if (own > blk)
+    {   // skip to the start of the next block of this shard
+        if (own > ~(uint64_t)0 / bsiz)
+        {   // the next block is beyond the end of the seed space
+            isdone = true;
+            return;
+        }
+        uint64_t skip = own * bsiz - pos;
+        uint64_t prog0 = prog;
+        pos = own * bsiz;
+        switch (searchtype)
+        {
+        case SEARCH_LIST:
+        case SEARCH_48ONLY:
+            prog += skip;
+            if (len)
+            {
+                idx = pos;
+                if (idx >= scnt)
+                    isdone = true;
+                else
+                    seed = sdata[idx];
+            }
+            else
+            {
+                seed = pos;
+                if (seed > MASK48)
+                    isdone = true;
+            }
+            break;
+        case SEARCH_INC:
+            prog += skip;
+            if (len)
+            {
+                uint64_t high = pos / len;
+                idx = pos % len;
+                seed = (high << 48) | sdata[idx];
+                if (high > (smax >> 48))
+                    isdone = true;
+            }
+            else
+            {
+                seed = pos;
+            }
+            if (seed > smax)
+                isdone = true;
+            break;
+        case SEARCH_BLOCKS:
+            // the blocks start at the lowest 16 upper bits
+            if (len)
+            {
+                idx = pos;
+                prog = 0x10000 * idx;
+                if (idx >= len)
+                    isdone = true;
+                else
+                    seed = sdata[idx];
+            }
+            else
+            {
+                seed = pos;
+                prog = pos << 16;
+                if (seed > MASK48)
+                    isdone = true;
+            }
+            break;
+        }
+        // the blocks of the other shards count as completed
+        if (prog > prog0)
+            completeItem(prog0, prog - prog0);
+    }
+
+    if (searchtype != SEARCH_BLOCKS)
+    {   // the item should not reach into the next block
+        uint64_t rem = (own + 1) * bsiz - pos;
+        if (*isize > rem)
+            *isize = rem;
+    }
+}
+
 bool SearchMaster::requestItem(SearchWorker *item)
 {
     if (isdone)
         return false;
+    if (stream)
+        return requestStreamItem(item);
 
     // QMutexLocker locker(&mutex);
 
@@ -785,36 +1201,44 @@ bool SearchMaster::requestItem(SearchWorker *item)
         count = 0;
     }
 
+    uint64_t isize = itemsize;
+    if (shardcnt > 1)
+    {
+        applyShard(&isize);
+        if (isdone)
+            return false;
+    }
+
     item->prog      = prog;
     item->idx       = idx;
     item->sstart    = seed;
-    item->scnt      = itemsize;
+    item->scnt      = isize;
     item->seed      = seed;
 
-    prog += itemsize;
+    prog += isize;
 
     if (searchtype == SEARCH_LIST)
     {
-        if (idx + itemsize > scnt)
+        if (idx + isize > scnt)
             item->scnt = scnt - idx;
-        idx += itemsize;
+        idx += isize;
         if (idx >= scnt)
             isdone = true;
     }
 
     if (searchtype == SEARCH_48ONLY)
     {
-        if (!slist.empty())
+        if (slen)
         {
-            if (idx + itemsize > scnt)
+            if (idx + isize > scnt)
                 item->scnt = scnt - idx;
-            idx += itemsize;
+            idx += isize;
             if (idx >= scnt)
                 isdone = true;
         }
         else
         {
-            seed += itemsize;
+            seed += isize;
             if (seed > MASK48)
                 isdone = true;
         }
@@ -822,20 +1246,20 @@ bool SearchMaster::requestItem(SearchWorker *item)
 
     if (searchtype == SEARCH_INC)
     {
-        if (!slist.empty())
+        if (slen)
         {
             uint64_t high = (seed >> 48) & 0xffff;
-            idx += itemsize;
-            high += idx / slist.size();
-            idx %= slist.size();
-            seed = (high << 48) | slist[idx];
+            idx += isize;
+            high += idx / slen;
+            idx %= slen;
+            seed = (high << 48) | sdata[idx];
             if (high > (smax >> 48))
                 isdone = true;
         }
         else
         {
-            // seed += itemsize; with overflow detection
-            uint64_t s = seed + itemsize;
+            // seed += isize; with overflow detection
+            uint64_t s = seed + isize;
             if (s < seed)
                 isdone = true; // overflow
             seed = s;
@@ -846,31 +1270,34 @@ bool SearchMaster::requestItem(SearchWorker *item)
 
     if (searchtype == SEARCH_BLOCKS)
     {
-        if (!slist.empty())
+        if (slen)
         {
             uint64_t high = (seed >> 48) & 0xffff;
-            high += itemsize;
+            high += isize;
             if (high >= 0x10000)
-            {
+            {   // the item ends with the block
+                item->scnt -= high - 0x10000;
                 high = 0;
                 idx++;
             }
-            if (idx >= slist.size())
+            prog = 0x10000 * idx + high;
+            if (idx >= slen)
                 isdone = true;
             else
-                seed = (high << 48) | slist[idx];
+                seed = (high << 48) | sdata[idx];
         }
         else
         {
             Pos origin = {0,0};
             uint64_t high = (seed >> 48) & 0xffff;
             uint64_t low = seed & MASK48;
-            high += itemsize;
+            high += isize;
             if (high >= 0x10000)
             {
-                item->scnt -= 0x10000 - high;
+                item->scnt -= high - 0x10000;
                 high = 0;
                 low++;
+                prog = low << 16;
 
                 for (; low <= MASK48 && !stop; low++)
                 {
@@ -894,6 +1321,137 @@ bool SearchMaster::requestItem(SearchWorker *item)
     return true;
 }
 
+bool SearchMaster::requestStreamItem(SearchWorker *item)
+{
+    SeedStream::Chunk chunk;
+    while (!stream->take(&chunk, 0))
+    {
+        if (stream->atEnd())
+        {
+            isdone = true;
+            return false;
+        }
+        if (stop)
+            return false;
+        // wait without holding up the other workers and the progress
+        mutex.unlock();
+        bool ok = stream->take(&chunk, 100);
+        mutex.lock();
+        if (ok)
+            break;
+        if (isdone)
+            return false;
+    }
+
+    item->chunk     = chunk.seeds;
+    item->slist     = chunk.seeds->data();
+    item->len       = chunk.seeds->size();
+    item->prog      = chunk.start;
+    item->idx       = 0;
+    item->sstart    = item->slist[0];
+    item->scnt      = (int) item->len;
+    item->seed      = item->slist[0];
+
+    prog = chunk.start + item->len;
+    scnt = stream->count();
+    seed = item->slist[item->len - 1];
+    return true;
+}
+
+void SearchMaster::holdResult(uint64_t listidx, uint64_t seed)
+{
+    QMutexLocker locker(&mutex);
+    held.emplace_back(listidx, seed);
+}
+
+bool SearchMaster::listResult(uint64_t, uint64_t)
+{
+    return false;
+}
+
+void SearchMaster::releaseHeldResults()
+{
+    std::sort(held.begin(), held.end());
+    for (const auto& it : held)
+        emit searchResult(it.second);
+    held.clear();
+}
+
+void SearchMaster::completeItem(uint64_t prog, uint64_t cnt)
+{
+    uint64_t a = prog, b = prog + cnt;
+    auto it = completed.upper_bound(a);
+    if (it != completed.begin())
+    {   // join with a preceding range that reaches the item
+        auto prev = std::prev(it);
+        if (prev->second >= b)
+            return;
+        if (prev->second >= a)
+        {
+            a = prev->first;
+            it = completed.erase(prev);
+        }
+    }
+    for (; it != completed.end() && it->first <= b; it = completed.erase(it))
+    {
+        if (it->second > b)
+            b = it->second;
+    }
+    completed[a] = b;
+}
+
+bool SearchMaster::isCompleted(uint64_t prog, uint64_t cnt)
+{
+    auto it = completed.upper_bound(prog);
+    if (it == completed.begin())
+        return false;
+    --it;
+    return it->second >= prog + cnt;
+}
+
+void SearchMaster::getCheckpoint(uint64_t *seed, Checkpoint *cp,
+                                 const std::vector<std::pair<uint64_t,uint64_t>>& pending)
+{
+    QMutexLocker locker(&mutex);
+    uint64_t low = prog;
+    *seed = this->seed;
+    for (SearchWorker *worker : workers)
+    {
+        if (worker->scnt <= 0 || isCompleted(worker->prog, worker->scnt))
+            continue; // no item or (skipped) completed item
+        if (worker->prog < low)
+        {
+            low = worker->prog;
+            *seed = worker->sstart;
+        }
+    }
+    for (const auto& p : pending)
+    {
+        if (p.first < low)
+        {
+            low = p.first;
+            *seed = p.second;
+        }
+    }
+    cp->ranges.clear();
+    for (const auto& r : completed)
+    {
+        if (r.second > low)
+            cp->ranges.emplace_back(r.first > low ? r.first : low, r.second);
+    }
+    cp->held = held;
+    cp->done = isdone && low == prog;
+}
+
+void SearchMaster::getStats(std::vector<uint64_t> *nseeds, std::vector<SearchThreadEnv::CondStats> *cstats)
+{
+    QMutexLocker locker(&mutex);
+    nseeds->clear();
+    for (SearchWorker *worker : workers)
+        nseeds->push_back(worker->nseeds);
+    *cstats = condstats;
+}
+
 void SearchMaster::onWorkerResult(uint64_t seed)
 {
     emit searchResult(seed);
@@ -901,6 +1459,7 @@ void SearchMaster::onWorkerResult(uint64_t seed)
 
 void SearchMaster::onWorkerFinished()
 {
+    emit workerFinished();
     QMutexLocker locker(&mutex);
     if (workers.empty())
         return;
@@ -910,55 +1469,190 @@ void SearchMaster::onWorkerFinished()
     for (SearchWorker *worker: workers)
         delete worker;
     workers.clear();
+    tunetimer.stop();
+    releaseHeldResults();
     emit searchFinish(isdone && !stop);
 }
 
+void SearchMaster::setThreadLimit(int n)
+{
+    threadlimit = n;
+    parkcond.wakeAll();
+}
+
+void SearchMaster::onTuneTimer()
+{
+    QMutexLocker locker(&mutex);
+    if (workers.empty() || stop || isdone)
+        return;
+
+    if (tunestep < 0)
+    {   // retune, as the cost of the conditions may change over the search
+        tunestep = 0;
+        tunemeasure = false;
+        setThreadLimit(tunecnt[0]);
+        tunetimer.start(TUNE_SETTLE_MS);
+        return;
+    }
+    if (!tunemeasure)
+    {   // the excess workers have finished their items
+        tuneprog = prog;
+        tuneclock.start();
+        tunemeasure = true;
+        tunetimer.start(TUNE_MEASURE_MS);
+        return;
+    }
+
+    // (the scheduled progress is a good measure, as items are short)
+    qreal dt = 1e-9 * tuneclock.nsecsElapsed();
+    tunerate[tunestep] = dt > 0 ? (prog - tuneprog) / dt : 0;
+    if (++tunestep < (int) tunecnt.size())
+    {
+        tunemeasure = false;
+        setThreadLimit(tunecnt[tunestep]);
+        tunetimer.start(TUNE_SETTLE_MS);
+        return;
+    }
+
+    // settle on the fastest, or on fewer threads that are about as fast
+    int best = 0;
+    for (int i = 1; i < (int) tunecnt.size(); i++)
+    {
+        if (tunerate[i] > tunerate[best])
+            best = i;
+    }
+    for (int i = 0; i < (int) tunecnt.size(); i++)
+    {
+        if (tunecnt[i] < tunecnt[best] && tunerate[i] >= 0.97 * tunerate[best])
+            best = i;
+    }
+    setThreadLimit(tunecnt[best]);
+    tunestep = -1;
+    tunetimer.start(1000 * TUNE_RETUNE_SEC);
+}
+
 
 SearchWorker::SearchWorker(SearchMaster *master)
     : QThread(nullptr)
     , master(master)
 {
-    this->slist         = master->slist.empty() ? NULL : master->slist.data();
-    this->len           = master->slist.size();
+    this->slist         = master->sdata;
+    this->slistidx      = master->slistidx.empty() ? NULL : master->slistidx.data();
+    this->len           = master->slen;
 
     this->prog          = master->prog;
     this->idx           = master->idx;
     this->sstart        = master->seed;
     this->scnt          = 0;
     this->seed          = master->seed;
-
-    this->env.stop      = &master->stop;
+    this->nseeds        = 0;
+    this->num           = 0;
+    this->parked        = false;
+    this->env           = nullptr;
 }
 
 SearchWorker::~SearchWorker()
 {
+    delete env;
 }
 
 bool SearchWorker::getNextItem()
 {
+    // finish the deferred checks of the previous item first
+    flushPending();
     QMutexLocker locker(&master->mutex);
-    return master->requestItem(this);
+    if (scnt > 0)
+    {
+        master->completeItem(prog, scnt);
+        nseeds += scnt;
+    }
+    // publish the condition statistics of the item
+    std::vector<SearchThreadEnv::CondStats>& cs = master->condstats;
+    for (size_t i = 0; i < cs.size() && i < env->condstats.size(); i++)
+    {
+        cs[i].tests += env->condstats[i].tests;
+        cs[i].fails += env->condstats[i].fails;
+        env->condstats[i] = SearchThreadEnv::CondStats();
+    }
+    if (num >= master->threadlimit)
+    {   // wait without an item while the thread count is tuned down
+        scnt = 0;
+        parked = true;
+        while (num >= master->threadlimit && !master->stop && !master->isdone)
+            master->parkcond.wait(&master->mutex, 100);
+        parked = false;
+        if (master->stop)
+            return false;
+    }
+    while (master->requestItem(this))
+    {   // skip the items that were completed before the search was resumed
+        if (!master->isCompleted(prog, scnt))
+            return true;
+    }
+    return false;
+}
+
+void SearchWorker::report(uint64_t seed, uint64_t i)
+{
+    if (env->l_defer)
+    {
+        pending.push_back(std::make_pair(seed, i));
+        if (pending.size() >= LUA_BATCH_SIZE)
+            flushPending();
+        return;
+    }
+    if (slistidx)
+        master->holdResult(slistidx[i], seed);
+    else if (master->searchtype != SEARCH_LIST || !master->listResult(i, seed))
+        emit result(seed);
+}
+
+void SearchWorker::flushPending()
+{
+    if (pending.empty())
+        return;
+    std::vector<char> ok;
+    env->runLuaBatches(ok);
+    for (size_t i = 0; i < pending.size() && i < ok.size(); i++)
+    {
+        if (!ok[i] || *env->stop)
+            continue;
+        uint64_t seed = pending[i].first;
+        if (slistidx)
+            master->holdResult(slistidx[pending[i].second], seed);
+        else if (master->searchtype != SEARCH_LIST || !master->listResult(pending[i].second, seed))
+            emit result(seed);
+    }
+    pending.clear();
 }
 
 void SearchWorker::run()
 {
+    // (the environment is allocated by the worker itself after it has been
+    // placed, so that its memory is first touched on the node it runs on)
+    int slot = enterWorkerSlot();
+    env = new SearchThreadEnv();
+    env->stop = &master->stop;
+
     Pos origin = {0,0};
-    env.init(master->mc, master->large, master->condtree);
+    env->init(master->mc, master->large, master->condtree);
+    env->l_defer = !env->l_batches.empty();
+    pending.clear();
 
     switch (master->searchtype)
     {
     case SEARCH_LIST:
-        while (!*env.stop && getNextItem())
+        while (!*env->stop && getNextItem())
         {   // seed = slist[..]
             uint64_t ie = idx+scnt < len ? idx+scnt : len;
             for (uint64_t i = idx; i < ie; i++)
             {
                 seed = slist[i];
-                env.setSeed(seed);
-                if (testTreeAt(origin, &env, PASS_FULL_64, nullptr) == COND_OK)
+                env->setSeed(seed);
+                if (testTreeAt(origin, env, PASS_FULL_64, nullptr) == COND_OK)
                 {
-                    if (!*env.stop)
-                        emit result(seed);
+                    if (!*env->stop)
+                        report(seed, i);
                 }
             }
             //if (ie == len) // done
@@ -967,7 +1661,7 @@ void SearchWorker::run()
         break;
 
     case SEARCH_48ONLY:
-        while (!*env.stop && getNextItem())
+        while (!*env->stop && getNextItem())
         {
             if (slist)
             {
@@ -975,10 +1669,10 @@ void SearchWorker::run()
                 for (uint64_t i = idx; i < ie; i++)
                 {
                     seed = slist[i];
-                    env.setSeed(seed);
-                    if (testTreeAt(origin, &env, PASS_FULL_48, nullptr) != COND_FAILED)
+                    env->setSeed(seed);
+                    if (testTreeAt(origin, env, PASS_FULL_48, nullptr) != COND_FAILED)
                     {
-                        if (!*env.stop)
+                        if (!*env->stop)
                             emit result(seed);
                     }
                 }
@@ -988,10 +1682,10 @@ void SearchWorker::run()
                 seed = sstart;
                 for (int i = 0; i < scnt; i++)
                 {
-                    env.setSeed(seed);
-                    if (testTreeAt(origin, &env, PASS_FULL_48, nullptr) != COND_FAILED)
+                    env->setSeed(seed);
+                    if (testTreeAt(origin, env, PASS_FULL_48, nullptr) != COND_FAILED)
                     {
-                        if (!*env.stop)
+                        if (!*env->stop)
                             emit result(seed);
                     }
 
@@ -1006,7 +1700,7 @@ void SearchWorker::run()
         break;
 
     case SEARCH_INC:
-        while (!*env.stop && getNextItem())
+        while (!*env->stop && getNextItem())
         {
             if (slist)
             {   // seed = (high << 48) | slist[..]
@@ -1017,11 +1711,11 @@ void SearchWorker::run()
                 {
                     seed = (high << 48) | slist[lowidx];
 
-                    env.setSeed(seed);
-                    if (testTreeAt(origin, &env, PASS_FULL_64, nullptr) == COND_OK)
+                    env->setSeed(seed);
+                    if (testTreeAt(origin, env, PASS_FULL_64, nullptr) == COND_OK)
                     {
-                        if (!*env.stop)
-                            emit result(seed);
+                        if (!*env->stop)
+                            report(seed);
                     }
 
                     if (++lowidx >= len)
@@ -1039,11 +1733,11 @@ void SearchWorker::run()
                 seed = sstart;
                 for (int i = 0; i < scnt; i++)
                 {
-                    env.setSeed(seed);
-                    if (testTreeAt(origin, &env, PASS_FULL_64, nullptr) == COND_OK)
+                    env->setSeed(seed);
+                    if (testTreeAt(origin, env, PASS_FULL_64, nullptr) == COND_OK)
                     {
-                        if (!*env.stop)
-                            emit result(seed);
+                        if (!*env->stop)
+                            report(seed);
                     }
 
                     if (seed == ~(uint64_t)0)
@@ -1057,7 +1751,7 @@ void SearchWorker::run()
         break;
 
     case SEARCH_BLOCKS:
-        while (!*env.stop && getNextItem())
+        while (!*env->stop && getNextItem())
         {   // seed = ([..] << 48) | low
             if (slist && idx >= len)
             {
@@ -1071,8 +1765,8 @@ void SearchWorker::run()
             else
                 low = sstart & MASK48;
 
-            env.setSeed(low);
-            if (testTreeAt(origin, &env, PASS_FULL_48, nullptr) == COND_FAILED)
+            env->setSeed(low);
+            if (testTreeAt(origin, env, PASS_FULL_48, nullptr) == COND_FAILED)
             {
                 continue;
             }
@@ -1081,11 +1775,11 @@ void SearchWorker::run()
             {
                 seed = (high << 48) | low;
 
-                env.setSeed(seed);
-                if (testTreeAt(origin, &env, PASS_FULL_64, nullptr) == COND_OK)
+                env->setSeed(seed);
+                if (testTreeAt(origin, env, PASS_FULL_64, nullptr) == COND_OK)
                 {
-                    if (!*env.stop)
-                        emit result(seed);
+                    if (!*env->stop)
+                        report(seed);
                 }
 
                 if (++high >= 0x10000)
@@ -1094,6 +1788,20 @@ void SearchWorker::run()
         }
         break;
     }
+
+    if (!*env->stop)
+        flushPending();
+    env->flushLuaProfile();
+
+    QMutexLocker locker(&master->mutex);
+    master->reseeds.seed64 += env->reseeds.seed64;
+    master->reseeds.seed48 += env->reseeds.seed48;
+    master->reseeds.sha += env->reseeds.sha;
+    locker.unlock();
+
+    delete env;
+    env = nullptr;
+    leaveWorkerSlot(slot);
 }
 
 
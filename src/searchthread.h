@@ -10,8 +10,13 @@
 #include <QElapsedTimer>
 #include <QTimer>
 #include <QMessageBox>
+#include <QWaitCondition>
 
 #include <deque>
+#include <map>
+#include <memory>
+
+class SeedMap;
 
 struct Session
 {
@@ -24,9 +29,26 @@ struct Session
     Gen48Config gen48;
     std::vector<Condition> cv;
     std::vector<uint64_t> slist;
+    std::shared_ptr<const SeedMap> slistmap; // binary 64-bit list (instead of slist)
+    Checkpoint cp;  // progress of a resumed search
 };
 
+// A sharded search processes only every n-th block of the search space,
+// where the blocks consist of SHARD_BLOCK candidates, or SHARD_BLOCK48
+// 48-bit bases for a search over the upper 16-bits of the seed.
+#define SHARD_BLOCK     4096
+#define SHARD_BLOCK48   16
+
+// The automatic thread count (SearchConfig::threads = 0) runs a worker for
+// every cpu, but lets only some of them take items. Each probe of a number of
+// active workers settles for TUNE_SETTLE_MS and measures the throughput for
+// TUNE_MEASURE_MS; the probes are repeated every TUNE_RETUNE_SEC.
+#define TUNE_SETTLE_MS  500
+#define TUNE_MEASURE_MS 2000
+#define TUNE_RETUNE_SEC 300
+
 struct SearchWorker;
+class SeedStream;
 
 struct SearchMaster : QObject
 {
@@ -37,10 +59,19 @@ public:
 
     bool set(QWidget *widget, const Session& s);
 
-    void preSearch();
+    virtual void preSearch();
+    // Points sdata/slen at the candidate list that the workers read.
+    void setListView();
 
     void startSearch();
     void stopSearch();
+    // Adds up to n workers to a running search that still has items to hand
+    // out, and returns the number of workers that were started.
+    int addWorkers(int n);
+    // Number of workers that are still running.
+    int activeWorkers();
+    // Sets the number of workers that may take items (with the mutex locked).
+    void setThreadLimit(int n);
 
     // Get search progress:
     //  status  : progress status summary
@@ -52,15 +83,49 @@ public:
     //  avg     : search speed average
     bool getProgress(QString *status, uint64_t *prog, uint64_t *end, uint64_t *seed, qreal *min, qreal *avg, qreal *max);
 
-    bool requestItem(SearchWorker *item);
+    // Fills in the next work item of a worker (with the mutex locked).
+    virtual bool requestItem(SearchWorker *item);
+    // Fills in the next chunk of a streamed list (with the mutex locked,
+    // which is released while waiting for the stream).
+    bool requestStreamItem(SearchWorker *item);
+    // Moves the search position to the next block of the shard and limits
+    // the item size to the end of that block.
+    void applyShard(uint64_t *isize);
+
+    // Holds a result until the search finishes, so that the results can be
+    // reported in the order of the original seed list.
+    virtual void holdResult(uint64_t listidx, uint64_t seed);
+    void releaseHeldResults();
+    // Reports a result of a list search with its position in the list. Returns
+    // false if the worker should emit the result as usual.
+    virtual bool listResult(uint64_t listidx, uint64_t seed);
+
+    // Tracks the completed items in units of the search progress, so that
+    // a resumed search can skip the items that were processed out of order.
+    virtual void completeItem(uint64_t prog, uint64_t cnt);
+    bool isCompleted(uint64_t prog, uint64_t cnt);
+    // Takes a snapshot of the progress for a checkpoint: the seed at the
+    // start of the earliest incomplete item and the completed items past it.
+    // The items that are processed outside of the workers (such as the leases
+    // of a coordinator) are given as pending (prog, sstart) pairs.
+    void getCheckpoint(uint64_t *seed, Checkpoint *cp,
+                       const std::vector<std::pair<uint64_t,uint64_t>>& pending = {});
+    // Gets the number of seeds in the completed items of each worker and
+    // the statistics of the conditions so far.
+    void getStats(std::vector<uint64_t> *nseeds, std::vector<SearchThreadEnv::CondStats> *cstats);
 
 public slots:
     void onWorkerResult(uint64_t seed);
     void onWorkerFinished();
+    void onTuneTimer();
 
 signals:
     void searchResult(uint64_t seed);
     void searchFinish(bool done);
+    void workerFinished();
+
+private:
+    SearchWorker *newWorker();
 
 public:
     struct TProg { uint64_t ns, prog; };
@@ -85,7 +150,17 @@ public:
     int                         itemsize;   // number of seeds per search item
     int                         threadcnt;  // numbr of worker threads
     Gen48Config                 gen48;      // 48-bit generator settings
+    int                         listorder;  // processing order of a seed list
+    int                         shardidx;   // shard (of shardcnt) to process
+    int                         shardcnt;
     std::vector<uint64_t>       slist;      // candidate list
+    std::vector<uint64_t>       slistidx;   // original list index of candidates
+    std::shared_ptr<const SeedMap> slistmap; // mapped candidate list (instead of slist)
+    SeedStream                * stream;     // streamed candidate list (instead of slist)
+    const uint64_t            * sdata;      // candidates of slist or slistmap
+    uint64_t                    slen;       // number of candidates
+    std::vector<std::pair<uint64_t,uint64_t>> held; // results (index, seed) on hold
+    std::map<uint64_t,uint64_t> completed; // completed progress (start -> end)
     uint64_t                    idx;        // index within candidate list
     uint64_t                    scnt;       // search space size
     uint64_t                    prog;       // search space progress tracker
@@ -93,6 +168,21 @@ public:
     uint64_t                    smin;
     uint64_t                    smax;
     bool                        isdone;
+    // generator reseeding stages of the finished workers
+    SearchThreadEnv::ReseedStats reseeds;
+    // condition statistics of the completed items
+    std::vector<SearchThreadEnv::CondStats> condstats;
+
+    bool                        autothreads; // tune the number of active workers
+    int                         threadlimit; // workers that may take items
+    QWaitCondition              parkcond;   // wakes the workers beyond the limit
+    QTimer                      tunetimer;
+    QElapsedTimer               tuneclock;
+    std::vector<int>            tunecnt;    // numbers of workers to probe
+    std::vector<qreal>          tunerate;   // and their throughput
+    int                         tunestep;   // current probe (-1: settled)
+    bool                        tunemeasure; // measuring, otherwise settling
+    uint64_t                    tuneprog;
 };
 
 
@@ -106,6 +196,12 @@ public:
     bool getNextItem();
     virtual void run() override;
 
+    // Reports a seed that satisfies the conditions, where i is its index in
+    // the seed list (if any). While Lua checks are deferred, the seeds are
+    // held back until flushPending() has run the batched checks on them.
+    void report(uint64_t seed, uint64_t i = 0);
+    void flushPending();
+
 signals:
     void result(uint64_t seed);
 
@@ -113,7 +209,9 @@ public:
     SearchMaster      * master;
 
     const uint64_t    * slist;      // candidate list
+    const uint64_t    * slistidx;   // original list index (if results are held)
     uint64_t            len;        // number of candidates
+    std::shared_ptr<const std::vector<uint64_t>> chunk; // of a streamed list
 
     /// current work item
     uint64_t            prog;       // search space progress
@@ -121,11 +219,15 @@ public:
     uint64_t            sstart;     // starting seed
     int                 scnt;       // number of seeds to process in this item
     uint64_t            seed;       // (out) current seed while processing
+    uint64_t            nseeds;     // seeds in the completed items
+    int                 num;        // index among the workers of the master
+    bool                parked;     // waiting for the thread limit to rise
     // the end seed is the highest unsigned seed value in the search space
     // (or the last entry in the seed list)
 
 private:
-    SearchThreadEnv     env;
+    SearchThreadEnv   * env;        // allocated by the running worker
+    std::vector<std::pair<uint64_t,uint64_t>> pending; // (seed, index) for Lua batches
 };
 
 
@@ -0,0 +1,408 @@
+#include "seedstream.h"
+
+#include "headless.h"
+
+#include <QFile>
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+
+SeedStream::SeedStream(const QString& path, bool follow, QObject *parent)
+    : QThread(parent)
+    , path(path)
+    , follow(follow)
+    , mutex()
+    , readable()
+    , writable()
+    , chunks()
+    , total()
+    , ended()
+    , err()
+    , stop(false)
+{
+}
+
+SeedStream::~SeedStream()
+{
+    stopReading();
+    // (a blocking read from stdin or a pipe cannot be interrupted)
+    if (!wait(1000))
+    {
+        terminate();
+        wait();
+    }
+}
+
+bool SeedStream::take(Chunk *chunk, int msec)
+{
+    QMutexLocker locker(&mutex);
+    if (chunks.empty() && !ended && msec > 0)
+        readable.wait(&mutex, msec);
+    if (chunks.empty())
+        return false;
+    *chunk = chunks.front();
+    chunks.pop_front();
+    writable.wakeOne();
+    return true;
+}
+
+bool SeedStream::atEnd()
+{
+    QMutexLocker locker(&mutex);
+    return ended && chunks.empty();
+}
+
+uint64_t SeedStream::count()
+{
+    QMutexLocker locker(&mutex);
+    return total;
+}
+
+QString SeedStream::error()
+{
+    QMutexLocker locker(&mutex);
+    return err;
+}
+
+void SeedStream::stopReading()
+{
+    stop = true;
+    writable.wakeAll();
+}
+
+bool SeedStream::push(std::vector<uint64_t> *seeds)
+{
+    QMutexLocker locker(&mutex);
+    while (chunks.size() >= STREAM_AHEAD && !stop)
+        writable.wait(&mutex, 100);
+    if (stop)
+        return false;
+    Chunk chunk;
+    chunk.seeds.reset(new std::vector<uint64_t>(std::move(*seeds)));
+    chunk.start = total;
+    total += chunk.seeds->size();
+    chunks.push_back(chunk);
+    readable.wakeOne();
+    seeds->clear();
+    return true;
+}
+
+// parses a line of the list: 1 for a seed, 0 for a line to skip, 2 for the
+// end marker, or -1 if it is invalid
+static int parseLine(const char *p, const char *e, uint64_t *seed)
+{
+    while (p < e && (*p == ' ' || *p == '\t'))
+        p++;
+    while (e > p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r'))
+        e--;
+    if (p == e)
+        return 0;
+    if (*p == '#')
+        return (e - p == 5 && memcmp(p, "#Done", 5) == 0) ? 2 : 0;
+
+    bool neg = false;
+    if (*p == '-' || *p == '+')
+        neg = *p++ == '-';
+    if (p == e || e - p > 20)
+        return -1;
+    uint64_t v = 0;
+    for (; p < e; p++)
+    {
+        if (*p < '0' || *p > '9')
+            return -1;
+        v = v * 10 + (*p - '0');
+    }
+    *seed = neg ? 0 - v : v;
+    return 1;
+}
+
+void SeedStream::run()
+{
+    QFile file;
+    bool ok;
+    if (path == "-")
+        ok = file.open(fileno(stdin), QIODevice::ReadOnly | QIODevice::Unbuffered);
+    else
+    {
+        file.setFileName(path);
+        ok = file.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    }
+
+    QString msg;
+    std::vector<uint64_t> seeds;
+    seeds.reserve(STREAM_CHUNK);
+    QByteArray buf; // incomplete line
+    uint64_t lineno = 0;
+    bool done = !ok;
+    if (!ok)
+        msg = QString("Failed to open seed list:\n\"%1\"").arg(path);
+
+    std::vector<char> data(1 << 16);
+    while (!done && !stop)
+    {
+        qint64 n = file.read(data.data(), data.size());
+        if (n < 0)
+        {
+            msg = QString("Failed to read seed list:\n\"%1\"").arg(path);
+            break;
+        }
+        if (n == 0)
+        {   // end of the file or pipe
+            if (!follow)
+                break;
+            // hand out what there is while waiting for the file to grow
+            if (!seeds.empty() && !push(&seeds))
+                break;
+            msleep(200);
+            continue;
+        }
+        buf.append(data.data(), n);
+
+        const char *p = buf.constData();
+        const char *e = p + buf.size();
+        const char *nl;
+        while (!done && (nl = (const char*) memchr(p, '\n', e - p)))
+        {
+            lineno++;
+            uint64_t seed;
+            int st = parseLine(p, nl, &seed);
+            if (st < 0)
+            {
+                msg = QString("Failed to parse line %1 of the seed list:\n\"%2\"")
+                    .arg(lineno).arg(QString::fromLocal8Bit(p, nl - p));
+                done = true;
+            }
+            else if (st == 2 && follow)
+                done = true;
+            else if (st == 1)
+            {
+                seeds.push_back(seed);
+                if (seeds.size() >= STREAM_CHUNK && !push(&seeds))
+                    done = true;
+            }
+            p = nl + 1;
+        }
+        buf.remove(0, p - buf.constData());
+    }
+
+    if (msg.isEmpty() && !done && !stop && !buf.isEmpty())
+    {   // last line without a newline
+        uint64_t seed;
+        int st = parseLine(buf.constData(), buf.constData() + buf.size(), &seed);
+        if (st < 0)
+            msg = QString("Failed to parse line %1 of the seed list.").arg(lineno + 1);
+        else if (st == 1)
+            seeds.push_back(seed);
+    }
+    if (msg.isEmpty() && !seeds.empty())
+        push(&seeds);
+
+    QMutexLocker locker(&mutex);
+    err = msg;
+    ended = true;
+    readable.wakeAll();
+}
+
+
+SeedMap::SeedMap()
+    : file()
+    , map()
+    , seeds()
+    , len()
+    , sorted()
+{
+}
+
+SeedMap::~SeedMap()
+{
+    if (map)
+        file.unmap(map);
+}
+
+bool SeedMap::isBinary(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    return file.read(8) == QByteArray("CVSEEDS", 8);
+}
+
+bool SeedMap::open(const QString& path, QString *err)
+{
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
+    *err = QString("Binary seed lists are not supported on this platform:\n\"%1\"").arg(path);
+    return false;
+#endif
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        *err = QString("Failed to open seed list:\n\"%1\"").arg(path);
+        return false;
+    }
+    qint64 size = file.size();
+    if (size >= 32)
+        map = file.map(0, size);
+    if (!map || memcmp(map, "CVSEEDS", 8) != 0)
+    {
+        *err = QString("Failed to map binary seed list:\n\"%1\"").arg(path);
+        return false;
+    }
+    const uchar *h = map;
+    uint32_t flags = h[24] | (h[25] << 8) | (h[26] << 16) | ((uint32_t) h[27] << 24);
+    // (the map is page aligned, so the seeds after the header are aligned)
+    seeds = (const uint64_t*) (map + 32);
+    len = (size - 32) / 8;
+    sorted = flags & RESULTS_SORTED;
+#ifdef Q_OS_UNIX
+    // a list search reads the list from front to back
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+#endif
+    return true;
+}
+
+// reads the number at the start of a line, as sscanf("%" PRId64) would
+static bool parseSeed(const char *p, const char *e, uint64_t *seed)
+{
+    while (p < e && isspace((unsigned char) *p))
+        p++;
+    bool neg = false;
+    if (p < e && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+    if (p == e || *p < '0' || *p > '9')
+        return false;
+    uint64_t v = 0;
+    for (; p < e && *p >= '0' && *p <= '9'; p++)
+        v = v * 10 + (*p - '0');
+    *seed = neg ? 0 - v : v;
+    return true;
+}
+
+namespace {
+struct TextChunk
+{
+    const char *b, *e;
+    std::vector<uint64_t> seeds;
+    std::vector<SeedTextLine> others; // (line numbers within the chunk)
+    uint64_t lines;
+};
+}
+
+static void parseChunk(const char *text, TextChunk *c, bool keep)
+{
+    const char *p = c->b;
+    c->seeds.reserve((c->e - c->b) / 16);
+    c->lines = 0;
+    while (p < c->e)
+    {
+        const char *nl = (const char*) memchr(p, '\n', c->e - p);
+        const char *le = nl ? nl : c->e;
+        uint64_t seed;
+        if (le == p || (le - p == 1 && *p == '\r'))
+            ; // empty line
+        else if (*p != '#' && parseSeed(p, le, &seed))
+            c->seeds.push_back(seed);
+        else if (keep)
+            c->others.push_back(SeedTextLine{c->lines, (size_t) (p - text), (size_t) (le - p)});
+        c->lines++;
+        if (!nl)
+            break;
+        p = nl + 1;
+    }
+}
+
+void parseSeedText(const char *text, size_t size, uint64_t firstline,
+                   std::vector<uint64_t>& seeds, std::vector<SeedTextLine> *others)
+{
+    size_t n = QThread::idealThreadCount();
+    if (n > size / PARSE_CHUNK + 1)
+        n = size / PARSE_CHUNK + 1;
+    if (n < 1)
+        n = 1;
+
+    std::vector<TextChunk> chunks(n);
+    const char *p = text, *end = text + size;
+    for (size_t i = 0; i < n; i++)
+    {
+        const char *e = end;
+        if (i + 1 < n)
+        {   // (the chunks end after a line break)
+            e = text + size * (i + 1) / n;
+            if (e < p)
+                e = p;
+            const char *nl = (const char*) memchr(e, '\n', end - e);
+            e = nl ? nl + 1 : end;
+        }
+        chunks[i].b = p;
+        chunks[i].e = e;
+        p = e;
+    }
+
+    std::vector<std::thread> tv;
+    for (size_t i = 1; i < n; i++)
+        tv.emplace_back(parseChunk, text, &chunks[i], others != NULL);
+    parseChunk(text, &chunks[0], others != NULL);
+    for (std::thread& th : tv)
+        th.join();
+
+    size_t cnt = seeds.size();
+    for (const TextChunk& c : chunks)
+        cnt += c.seeds.size();
+    seeds.reserve(cnt);
+    uint64_t lineno = firstline;
+    for (TextChunk& c : chunks)
+    {
+        seeds.insert(seeds.end(), c.seeds.begin(), c.seeds.end());
+        std::vector<uint64_t>().swap(c.seeds);
+        if (others)
+        {
+            for (SeedTextLine& line : c.others)
+            {
+                line.lineno += lineno;
+                others->push_back(line);
+            }
+        }
+        lineno += c.lines;
+    }
+}
+
+bool loadSeedList(std::vector<uint64_t>& seeds, const QString& path)
+{
+    if (SeedMap::isBinary(path))
+    {
+        SeedMap map;
+        QString err;
+        if (!map.open(path, &err))
+            return false;
+        seeds.assign(map.data(), map.data() + map.size());
+        return true;
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    size_t size = file.size();
+    QByteArray data;
+    const char *text = NULL;
+    uchar *map = size ? file.map(0, size) : NULL;
+    if (map)
+        text = (const char*) map;
+    else
+    {   // (such as a pipe)
+        data = file.readAll();
+        text = data.constData();
+        size = data.size();
+    }
+    seeds.clear();
+    parseSeedText(text, size, 1, seeds, NULL);
+    if (map)
+        file.unmap(map);
+    // (a list without seeds fails to load, as with loadSavedSeeds)
+    return !seeds.empty();
+}
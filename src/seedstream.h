@@ -0,0 +1,121 @@
+#ifndef SEEDSTREAM_H
+#define SEEDSTREAM_H
+
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Seeds per chunk of a streamed list (the work item of a worker), and the
+// number of chunks that are read ahead of the workers.
+#define STREAM_CHUNK    4096
+#define STREAM_AHEAD    256
+
+// Reads a 64-bit seed list in the background, so that a list search can
+// start before the list is complete and the list does not have to fit into
+// memory: from stdin ("-"), a pipe, or a file that is followed as it is
+// appended to, until a "#Done" line (as at the end of the text output of a
+// finished search). Lines that start with '#' are skipped, so the output of
+// one search can be the input of the next.
+class SeedStream : public QThread
+{
+    Q_OBJECT
+
+public:
+    struct Chunk
+    {
+        std::shared_ptr<const std::vector<uint64_t>> seeds;
+        uint64_t start;     // position of the first seed in the stream
+    };
+
+    SeedStream(const QString& path, bool follow, QObject *parent = 0);
+    virtual ~SeedStream();
+
+    // Takes the next chunk, waiting for up to msec for one to be read.
+    bool take(Chunk *chunk, int msec);
+    // The stream is at its end when all chunks have been taken.
+    bool atEnd();
+    // Number of seeds that have been read so far.
+    uint64_t count();
+    QString error();
+
+    void stopReading();
+
+protected:
+    virtual void run() override;
+
+private:
+    bool push(std::vector<uint64_t> *seeds);
+
+public:
+    QString path;
+    bool follow;
+
+private:
+    QMutex mutex;
+    QWaitCondition readable;    // chunks are available
+    QWaitCondition writable;    // the read ahead has room
+    std::deque<Chunk> chunks;
+    uint64_t total;
+    bool ended;
+    QString err;
+    std::atomic_bool stop;
+};
+
+// A binary seed list (the binary output format of a headless search, see
+// headless.h) that is mapped into memory, so that a list search reads the
+// seeds straight from the page cache without parsing or copying the list.
+// (The seeds are little-endian, so the list can only be mapped on a
+// little-endian host.)
+class SeedMap
+{
+public:
+    SeedMap();
+    ~SeedMap();
+
+    // Does the file start with the header of the binary format?
+    static bool isBinary(const QString& path);
+    bool open(const QString& path, QString *err);
+
+    const uint64_t *data() const { return seeds; }
+    uint64_t size() const { return len; }
+    // the seeds are in ascending order (as signed values)
+    bool isSorted() const { return sorted; }
+
+private:
+    QFile file;
+    uchar *map;
+    const uint64_t *seeds;
+    uint64_t len;
+    bool sorted;
+};
+
+// Text lists are parsed in chunks of at least this size (in bytes) by
+// separate threads.
+#define PARSE_CHUNK     (1 << 20)
+
+// A line of a text list that is not a seed (see parseSeedText).
+struct SeedTextLine
+{
+    uint64_t lineno;    // line number, counted from firstline
+    size_t pos, len;    // span of the line in the text
+};
+
+// Parses the seeds of a text list, which is split at line breaks into chunks
+// that are parsed in parallel and joined in order. A line is a seed if it
+// starts with a decimal number (as read by sscanf). Empty lines are skipped,
+// while the remaining lines (such as the '#' lines of a session header) are
+// added to others, if given.
+void parseSeedText(const char *text, size_t size, uint64_t firstline,
+                   std::vector<uint64_t>& seeds, std::vector<SeedTextLine> *others);
+
+// Loads a seed list into memory, from a text or a binary file.
+bool loadSeedList(std::vector<uint64_t>& seeds, const QString& path);
+
+#endif // SEEDSTREAM_H
@@ -0,0 +1,335 @@
+#include "workerpolicy.h"
+
+#include <QDir>
+#include <QFile>
+#include <QMutex>
+#include <QStringList>
+#include <QThread>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED  1
+#define MPOL_INTERLEAVE 3
+#endif
+#endif
+
+WorkerPolicy g_workerpolicy;
+
+// parses a cpu list as in "0-3,8,10-11"
+static bool parseCpuList(const QString& s, std::vector<int> *cpus)
+{
+    cpus->clear();
+    const QStringList parts = s.trimmed().split(',');
+    for (const QString& part : parts)
+    {
+        QStringList range = part.split('-');
+        if (range.size() > 2)
+            return false;
+        bool ok1, ok2;
+        int a = range.first().toInt(&ok1);
+        int b = range.last().toInt(&ok2);
+        if (!ok1 || !ok2 || a < 0 || b < a)
+            return false;
+        for (int i = a; i <= b; i++)
+            cpus->push_back(i);
+    }
+    return !cpus->empty();
+}
+
+bool WorkerPolicy::parseAffinity(const char *arg)
+{
+    if (strcmp(arg, "compact") == 0)
+        affinity = AFFINITY_COMPACT;
+    else if (strcmp(arg, "scatter") == 0)
+        affinity = AFFINITY_SCATTER;
+    else if (parseCpuList(arg, &cpus))
+        affinity = AFFINITY_LIST;
+    else
+        return false;
+    return true;
+}
+
+bool WorkerPolicy::parseNuma(const char *arg)
+{
+    if (strcmp(arg, "local") == 0)
+        numa = NUMA_LOCAL;
+    else if (strcmp(arg, "interleave") == 0)
+        numa = NUMA_INTERLEAVE;
+    else
+        return false;
+    return true;
+}
+
+bool WorkerPolicy::parseNice(const char *arg)
+{
+    if (strcmp(arg, "idle") == 0)
+    {
+        idle = true;
+        return true;
+    }
+    char *end;
+    long n = strtol(arg, &end, 10);
+    if (*arg == 0 || *end != 0 || n < 1 || n > 19)
+        return false;
+    nice = (int) n;
+    return true;
+}
+
+
+struct CpuInfo
+{
+    int id;
+    int node;
+    int core;   // physical core (unique across packages)
+    int smt;    // index among the siblings of the core
+    int rank;   // index within the node in compact order
+};
+
+static QMutex g_slotmutex;
+static std::vector<char> g_slots;       // worker slots in use
+static std::vector<CpuInfo> g_compact;  // cpus in compact order
+static std::vector<CpuInfo> g_scatter;  // cpus in scatter order
+static int g_nodecnt = 0;
+static bool g_topology = false;
+static std::atomic_bool g_warned (false);
+
+static void warnPolicy(const char *what)
+{
+    // (reported once, as every worker would fail the same way)
+    if (!g_warned.exchange(true))
+        fprintf(stderr, "Failed to apply the worker policy: %s\n", what);
+}
+
+#if defined(__linux__)
+static int readSysInt(const QString& path, int def)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return def;
+    bool ok;
+    int v = QString(file.readAll()).trimmed().toInt(&ok);
+    return ok ? v : def;
+}
+#endif
+
+// reads the cpus that the process may run on and their NUMA nodes
+static void initTopology()
+{
+    std::vector<CpuInfo> cpus;
+    std::map<int, int> nodeof;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int i = 0; i < CPU_SETSIZE; i++)
+            if (CPU_ISSET(i, &set))
+                cpus.push_back(CpuInfo{i, 0, i, 0, 0});
+    }
+    QDir nodes("/sys/devices/system/node", "node*", QDir::Name, QDir::Dirs);
+    for (const QString& name : nodes.entryList())
+    {
+        bool ok;
+        int node = name.mid(4).toInt(&ok);
+        QFile file(nodes.filePath(name + "/cpulist"));
+        if (!ok || !file.open(QIODevice::ReadOnly))
+            continue;
+        std::vector<int> ids;
+        if (parseCpuList(QString(file.readAll()), &ids))
+            for (int id : ids)
+                nodeof[id] = node;
+    }
+#endif
+    if (cpus.empty())
+    {
+        for (int i = 0, n = QThread::idealThreadCount(); i < n; i++)
+            cpus.push_back(CpuInfo{i, 0, i, 0, 0});
+    }
+
+    std::map<int, int> nodeidx; // NUMA node -> dense index
+    std::map<int, int> siblings;
+    for (CpuInfo& c : cpus)
+    {
+        auto it = nodeof.find(c.id);
+        int node = it == nodeof.end() ? 0 : it->second;
+        if (!nodeidx.count(node))
+        {
+            int n = (int) nodeidx.size();
+            nodeidx[node] = n;
+        }
+        c.node = node;
+#if defined(__linux__)
+        QString topo = QString("/sys/devices/system/cpu/cpu%1/topology/").arg(c.id);
+        int pkg = readSysInt(topo + "physical_package_id", 0);
+        int core = readSysInt(topo + "core_id", c.id);
+        c.core = (pkg << 16) | (core & 0xffff);
+#endif
+        c.smt = siblings[c.core]++;
+    }
+    g_nodecnt = (int) nodeidx.size();
+
+    std::sort(cpus.begin(), cpus.end(), [&](const CpuInfo& a, const CpuInfo& b) {
+        int na = nodeidx[a.node], nb = nodeidx[b.node];
+        if (na != nb) return na < nb;
+        if (a.smt != b.smt) return a.smt < b.smt;
+        return a.id < b.id;
+    });
+    std::map<int, int> rank;
+    for (CpuInfo& c : cpus)
+        c.rank = rank[c.node]++;
+    g_compact = cpus;
+
+    std::stable_sort(cpus.begin(), cpus.end(), [&](const CpuInfo& a, const CpuInfo& b) {
+        if (a.rank != b.rank) return a.rank < b.rank;
+        return nodeidx[a.node] < nodeidx[b.node];
+    });
+    g_scatter = cpus;
+    g_topology = true;
+}
+
+// places the calling thread for the given slot
+static void placeThread(int slot)
+{
+    const WorkerPolicy& wp = g_workerpolicy;
+    std::vector<int> cpus; // that the thread may run on
+    int node = -1;
+
+    switch (wp.affinity)
+    {
+    case WorkerPolicy::AFFINITY_COMPACT:
+    case WorkerPolicy::AFFINITY_SCATTER: {
+        const std::vector<CpuInfo>& order =
+            wp.affinity == WorkerPolicy::AFFINITY_COMPACT ? g_compact : g_scatter;
+        const CpuInfo& c = order[slot % order.size()];
+        cpus.push_back(c.id);
+        node = c.node;
+        break; }
+    case WorkerPolicy::AFFINITY_LIST: {
+        int id = wp.cpus[slot % wp.cpus.size()];
+        cpus.push_back(id);
+        for (const CpuInfo& c : g_compact)
+            if (c.id == id)
+                node = c.node;
+        break; }
+    default:
+        if (wp.numa == WorkerPolicy::NUMA_LOCAL && g_nodecnt > 1)
+        {   // the cpus of the node in turn
+            node = g_scatter[slot % g_nodecnt].node;
+            for (const CpuInfo& c : g_compact)
+                if (c.node == node)
+                    cpus.push_back(c.id);
+        }
+        break;
+    }
+
+    (void) node;
+#if defined(__linux__)
+    if (!cpus.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int id : cpus)
+            if (id < CPU_SETSIZE)
+                CPU_SET(id, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            warnPolicy("cpu affinity");
+    }
+#ifdef SYS_set_mempolicy
+    if (wp.numa != WorkerPolicy::NUMA_NONE && g_nodecnt > 1)
+    {
+        unsigned long mask[16] = {};
+        const int bits = 8 * sizeof(unsigned long);
+        int mode = MPOL_INTERLEAVE;
+        for (const CpuInfo& c : g_compact)
+        {
+            if (wp.numa == WorkerPolicy::NUMA_INTERLEAVE || c.node == node)
+                if (c.node < 16 * bits)
+                    mask[c.node / bits] |= 1UL << (c.node % bits);
+        }
+        if (wp.numa == WorkerPolicy::NUMA_LOCAL)
+            mode = MPOL_PREFERRED;
+        if (wp.numa == WorkerPolicy::NUMA_INTERLEAVE || node >= 0)
+        {
+            if (syscall(SYS_set_mempolicy, mode, mask, 16 * bits) != 0)
+                warnPolicy("NUMA memory policy");
+        }
+    }
+#endif
+    if (wp.idle)
+    {
+        struct sched_param sp = {};
+        if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp) != 0)
+            warnPolicy("idle scheduling");
+    }
+    else if (wp.nice)
+    {   // (the niceness of a thread on Linux applies to its thread id)
+        if (setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), wp.nice) != 0)
+            warnPolicy("nice");
+    }
+#elif defined(_WIN32)
+    if (!cpus.empty())
+    {
+        DWORD_PTR mask = 0;
+        for (int id : cpus)
+            if (id < (int) (8 * sizeof(mask)))
+                mask |= (DWORD_PTR) 1 << id;
+        if (!mask || !SetThreadAffinityMask(GetCurrentThread(), mask))
+            warnPolicy("cpu affinity");
+    }
+    if (wp.numa != WorkerPolicy::NUMA_NONE && wp.affinity == WorkerPolicy::AFFINITY_NONE)
+        warnPolicy("NUMA placement is only supported on Linux");
+    if (wp.idle || wp.nice)
+    {
+        int prio = wp.idle ? THREAD_PRIORITY_IDLE :
+                   wp.nice >= 10 ? THREAD_PRIORITY_LOWEST : THREAD_PRIORITY_BELOW_NORMAL;
+        if (!SetThreadPriority(GetCurrentThread(), prio))
+            warnPolicy("thread priority");
+    }
+#else
+    if (!cpus.empty() || wp.numa != WorkerPolicy::NUMA_NONE)
+        warnPolicy("cpu and NUMA placement are not supported on this platform");
+    if (wp.idle || wp.nice)
+        QThread::currentThread()->setPriority(wp.idle ? QThread::IdlePriority : QThread::LowPriority);
+#endif
+}
+
+int enterWorkerSlot()
+{
+    if (g_workerpolicy.isDefault())
+        return -1;
+
+    QMutexLocker locker(&g_slotmutex);
+    if (!g_topology)
+        initTopology();
+    size_t slot = 0;
+    while (slot < g_slots.size() && g_slots[slot])
+        slot++;
+    if (slot == g_slots.size())
+        g_slots.push_back(0);
+    g_slots[slot] = 1;
+    locker.unlock();
+
+    placeThread((int) slot);
+    return (int) slot;
+}
+
+void leaveWorkerSlot(int slot)
+{
+    if (slot < 0)
+        return;
+    QMutexLocker locker(&g_slotmutex);
+    g_slots[slot] = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef WORKERPOLICY_H
+#define WORKERPOLICY_H
+
+#include <vector>
+
+// Placement and scheduling of the search worker threads (from the command
+// line of the headless modes; the defaults leave the workers to the OS).
+struct WorkerPolicy
+{
+    enum { AFFINITY_NONE, AFFINITY_COMPACT, AFFINITY_SCATTER, AFFINITY_LIST };
+    enum { NUMA_NONE, NUMA_LOCAL, NUMA_INTERLEAVE };
+
+    int affinity;
+    std::vector<int> cpus;  // logical cpus for AFFINITY_LIST
+    int numa;
+    int nice;               // niceness of the workers (0: unchanged)
+    bool idle;              // run the workers only on otherwise idle cpus
+
+    WorkerPolicy() : affinity(), cpus(), numa(), nice(), idle() {}
+
+    bool isDefault() const { return !affinity && !numa && !nice && !idle; }
+
+    // Parse the option values, returning false if they are invalid:
+    //  affinity: compact, scatter or a cpu list such as "0-7,16-23"
+    //  numa:     local or interleave
+    //  nice:     1..19 or idle
+    bool parseAffinity(const char *arg);
+    bool parseNuma(const char *arg);
+    bool parseNice(const char *arg);
+};
+
+extern WorkerPolicy g_workerpolicy;
+
+// Takes the lowest free worker slot and places the calling thread according
+// to the worker policy. Compact placement fills the cores of one NUMA node
+// before the next (and physical cores before their SMT siblings), while
+// scatter alternates between the nodes. Without a cpu affinity, NUMA local
+// placement binds the thread to the cpus of a node. The slot is released
+// with leaveWorkerSlot() when the worker is done (-1: no placement).
+int enterWorkerSlot();
+void leaveWorkerSlot(int slot);
+
+#endif // WORKERPOLICY_H
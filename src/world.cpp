@@ -1,5 +1,6 @@
 #include "world.h"
 
+#include "scripts.h"
 #include "util.h"
 
 #include <QPainterPath>
@@ -138,6 +139,7 @@ QStringList VarPos::detail() const
 Quad::Quad(const Level* l, int64_t i, int64_t j)
     : wi(l->wi),dim(l->dim),lopt(l->lopt),g(&l->g),sn(&l->sn),hd(l->hd),scale(l->scale)
     , ti(i),tj(j),blocks(l->blocks),pixs(l->pixs),sopt(l->sopt)
+    , luahash(l->luahash),luapath(l->luapath)
     , biomes(),rgb(),img(),spos()
 {
     isdel = l->isdel;
@@ -174,6 +176,9 @@ void getStructs(std::vector<VarPos> *out, const StructureConfig sconf,
         setupGenerator(&g, wi.mc, wi.large);
         applySeed(&g, dim, wi.seed);
     }
+    // the surface noise is only needed if the terrain check is not cached
+    SurfaceNoise sn;
+    bool sninit = false;
 
     for (int i = si0; i <= si1; i++)
     {
@@ -199,9 +204,17 @@ void getStructs(std::vector<VarPos> *out, const StructureConfig sconf,
 
                 if (sconf.structType == End_City)
                 {
-                    SurfaceNoise sn;
-                    initSurfaceNoise(&sn, DIM_END, wi.seed);
-                    int y = isViableEndCityTerrain(&g, &sn, p.x, p.z);
+                    int y;
+                    if (!getCachedTerrain(&g, End_City, p.x, p.z, &y))
+                    {
+                        if (!sninit)
+                        {
+                            initSurfaceNoise(&sn, DIM_END, wi.seed);
+                            sninit = true;
+                        }
+                        y = isViableEndCityTerrain(&g, &sn, p.x, p.z);
+                        setCachedTerrain(&g, End_City, p.x, p.z, y);
+                    }
                     if (!y)
                         continue;
                     int n = getEndCityPieces(pieces, wi.seed, p.x >> 4, p.z >> 4);
@@ -221,13 +234,16 @@ void getStructs(std::vector<VarPos> *out, const StructureConfig sconf,
                         wi.mc, wi.seed, p.x >> 4, p.z >> 4);
                     vp.pieces.assign(pieces, pieces+n);
                 }
-                else if (g.mc >= MC_1_18)
+                else if (g.mc >= MC_1_18 && g_extgen.estimateTerrain)
                 {
-                    if (g_extgen.estimateTerrain &&
-                        !isViableStructureTerrain(sconf.structType, &g, p.x, p.z))
+                    int ok;
+                    if (!getCachedTerrain(&g, sconf.structType, p.x, p.z, &ok))
                     {
-                        continue;
+                        ok = isViableStructureTerrain(sconf.structType, &g, p.x, p.z);
+                        setCachedTerrain(&g, sconf.structType, p.x, p.z, ok);
                     }
+                    if (!ok)
+                        continue;
                 }
 
                 getVariant(&vp.v, sconf.structType, wi.mc, wi.seed, p.x, p.z, id);
@@ -373,6 +389,34 @@ void applyHeightShading(unsigned char *rgb, Range r,
     }
 }
 
+// maps overlay values onto a translucent heatmap (transparent if NaN)
+static void valuesToHeatmap(uchar *rgba, const float *values, int n, float vmin, float vmax)
+{
+    static const uchar grad[][3] = {
+        {0, 0, 255}, {0, 255, 255}, {0, 255, 0}, {255, 255, 0}, {255, 0, 0},
+    };
+    const int gn = sizeof(grad) / sizeof(grad[0]) - 1;
+    float range = vmax - vmin;
+    for (int i = 0; i < n; i++)
+    {
+        uchar *col = rgba + 4*i;
+        float v = values[i];
+        if (v != v)
+        {
+            col[0] = col[1] = col[2] = col[3] = 0;
+            continue;
+        }
+        float t = range > 0 ? (v - vmin) / range : 0;
+        t = (t <= 0) ? 0 : (t >= 1) ? gn : t * gn;
+        int k = (int) t;
+        if (k >= gn) k = gn - 1;
+        float u = t - k;
+        for (int c = 0; c < 3; c++)
+            col[c] = (uchar) (grad[k][c] + (grad[k+1][c] - grad[k][c]) * u);
+        col[3] = 160;
+    }
+}
+
 void Quad::run()
 {
     if (done || *isdel)
@@ -380,6 +424,32 @@ void Quad::run()
         return;
     }
 
+    if (luahash)
+    {   // Lua overlay tile
+        int x = ti*pixs, z = tj*pixs, w = pixs, h = pixs;
+        std::vector<float> values(w*h);
+        float vmin = 0, vmax = 1;
+        QString err;
+        Range r = {scale, x, z, w, h, 0, 1};
+        if (!runTileScript(luahash, luapath, wi.mc, wi.large, wi.seed, r, isdel,
+            values.data(), &vmin, &vmax, &err))
+        {
+            if (*isdel)
+                return;
+            fprintf(
+                stderr,
+                "Failed to evaluate Lua tile - "
+                "seed:%" PRId64 " @ [%d %d] (%d %d) 1:%d\n%s\n",
+                wi.seed, x, z, w, h, scale, err.toLocal8Bit().data());
+            std::fill(values.begin(), values.end(), NAN);
+        }
+        rgb = new uchar[w*h * 4];
+        valuesToHeatmap(rgb, values.data(), w*h, vmin, vmax);
+        img = new QImage(rgb, w, h, 4*w, QImage::Format_RGBA8888);
+        done = true;
+        return;
+    }
+
     if (pixs > 0)
     {
         if (lopt.mode == LOPT_STRUCTS && dim == DIM_OVERWORLD)
@@ -460,7 +530,7 @@ Level::Level()
     : cells(),g(),sn(),entry(),lopt(),wi(),dim()
     , tx(),tz(),tw(),th()
     , hd(),scale(),blocks(),pixs()
-    , sopt()
+    , sopt(),luahash(),luapath()
 {
 }
 
@@ -584,6 +654,33 @@ void Level::init4struct(QWorld *w, int sopt)
     this->isdel = &w->isdel;
 }
 
+void Level::init4lua(QWorld *w, int pix, int layerscale)
+{
+    this->world = w;
+    this->lopt = w->lopt;
+    this->wi = w->wi;
+    this->dim = w->dim;
+
+    tx = tz = tw = th = 0;
+
+    hd = 0;
+    scale = layerscale;
+    pixs = pix;
+    blocks = pix * layerscale;
+    if (layerscale < 16)
+    {   // overlay values are at most per chunk
+        int f = 16 / layerscale;
+        scale *= f;
+        pixs /= f;
+        if (pixs == 0)
+            pixs = 1;
+    }
+    sopt = D_NONE;
+    luahash = w->luahash;
+    luapath = w->luapath;
+    this->isdel = &w->isdel;
+}
+
 static float sqdist(int x, int z) { return x*x + z*z; }
 
 void Level::resizeLevel(std::vector<Quad*>& cache, int64_t x, int64_t z, int64_t w, int64_t h)
@@ -615,7 +712,7 @@ void Level::resizeLevel(std::vector<Quad*>& cache, int64_t x, int64_t z, int64_t
         int gx = c->ti - x;
         int gz = c->tj - z;
 
-        if (c->blocks == blocks && c->sopt == sopt && c->dim == dim)
+        if (c->blocks == blocks && c->sopt == sopt && c->dim == dim && c->luahash == luahash)
         {
             // remove outside quads from schedule
             if (world->take(c))
@@ -723,9 +820,13 @@ QWorld::QWorld(WorldInfo wi, int dim, LayerOpt lopt)
     , lopt(lopt)
     , lvb()
     , lvs()
+    , lvl()
     , activelv()
     , cachedbiomes()
     , cachedstruct()
+    , cachedlua()
+    , luahash()
+    , luapath()
     , memlimit()
     , mutex()
     , queue()
@@ -776,6 +877,8 @@ QWorld::~QWorld()
         delete q;
     for (Quad *q : cachedstruct)
         delete q;
+    for (Quad *q : cachedlua)
+        delete q;
     if (spawn && spawn != (Pos*)-1)
     {
         delete spawn;
@@ -814,6 +917,24 @@ void QWorld::setDim(int dim, LayerOpt lopt)
     lvb.resize(lcnt);
     for (int i = 0, scale = 1; i < lcnt; i++, scale *= 4)
         lvb[i].init4map(this, pixs, scale);
+
+    lvl.clear();
+    if (luahash)
+    {
+        lvl.resize(lcnt);
+        for (int i = 0, scale = 1; i < lcnt; i++, scale *= 4)
+            lvl[i].init4lua(this, pixs, scale);
+    }
+}
+
+void QWorld::setLuaOverlay(uint64_t hash, const QString& path)
+{
+    clear();
+    // the tiles of the previous script (or version) are discarded
+    cleancache(cachedlua, 0);
+    luahash = hash;
+    luapath = path;
+    setDim(dim, lopt);
 }
 
 void QWorld::setSelectPos(QPoint pos)
@@ -926,6 +1047,13 @@ void QWorld::clear()
         if (!q->done)
             q->stopped = true;
     }
+    for (Level& l : lvl)
+        l.setInactive(cachedlua);
+    for (Quad *q : cachedlua)
+    {
+        if (!q->done)
+            q->stopped = true;
+    }
 }
 
 void QWorld::startWorkers()
@@ -1171,6 +1299,31 @@ void QWorld::draw(QPainter& painter, int vw, int vh, qreal focusx, qreal focusz,
         }
     }
 
+    if (!lvl.empty())
+    {   // Lua overlay, where the tiles of the finer level take precedence
+        QRegion covered;
+        for (int li = activelv; li <= activelv+1; li++)
+        {
+            if (li < 0 || li >= (int)lvl.size())
+                continue;
+            if (li > activelv)
+                painter.setClipRegion(QRegion(0, 0, vw, vh).subtracted(covered));
+            for (Quad *q : lvl[li].cells)
+            {
+                if (!q->img)
+                    continue;
+                qreal ps = q->blocks * blocks2pix;
+                qreal px = vw/2.0 + (q->ti) * ps - focusx * blocks2pix;
+                qreal pz = vh/2.0 + (q->tj) * ps - focusz * blocks2pix;
+                QRect rec(floor(px),floor(pz), ceil(ps),ceil(ps));
+                painter.drawImage(rec, *q->img);
+                if (li == activelv)
+                    covered += rec;
+            }
+        }
+        painter.setClipping(false);
+    }
+
     if (sshow[D_GRID] && gridspacing)
     {
         int64_t gs = gridspacing;
@@ -1500,6 +1653,14 @@ void QWorld::draw(QPainter& painter, int vw, int vh, qreal focusx, qreal focusz,
         else
             l.setInactive(cachedbiomes);
     }
+    for (int li = lvl.size()-1; li >= 0; --li)
+    {
+        Level& l = lvl[li];
+        if (li == activelv || li == activelv+1)
+            l.update(cachedlua, bx0, bz0, bx1, bz1);
+        else
+            l.setInactive(cachedlua);
+    }
 
     if (spawn == NULL && lopt.mode != LOPT_STRUCTS)
     {   // start the spawn and stronghold worker thread if this is the first run
@@ -1577,6 +1738,7 @@ void QWorld::draw(QPainter& painter, int vw, int vh, qreal focusx, qreal focusz,
 
     cleancache(cachedbiomes, cachesize);
     cleancache(cachedstruct, cachesize);
+    cleancache(cachedlua, cachesize);
 
     if (0)
     {   // debug outline
@@ -70,6 +70,8 @@ struct Quad : public Scheduled
     int blocks;
     int pixs;
     int sopt;
+    uint64_t luahash;   // script of a Lua overlay tile (0 otherwise)
+    QString luapath;
 
     int *biomes;
     uchar *rgb;
@@ -87,6 +89,7 @@ struct Level
 
     void init4map(QWorld *world, int pix, int layerscale);
     void init4struct(QWorld *world, int sopt);
+    void init4lua(QWorld *world, int pix, int layerscale);
 
     void resizeLevel(std::vector<Quad*>& cache, int64_t x, int64_t z, int64_t w, int64_t h);
     void update(std::vector<Quad*>& cache, qreal bx0, qreal bz0, qreal bx1, qreal bz1);
@@ -106,6 +109,8 @@ struct Level
     int blocks;
     int pixs;
     int sopt;
+    uint64_t luahash;
+    QString luapath;
     double vis;
     std::atomic_bool *isdel;
 };
@@ -147,6 +152,8 @@ public:
     virtual ~QWorld();
 
     void setDim(int dim, LayerOpt lopt);
+    // sets the script for the Lua overlay (hash 0 disables the overlay)
+    void setLuaOverlay(uint64_t hash, const QString& path);
 
     void cleancache(std::vector<Quad*>& cache, unsigned int maxsize);
 
@@ -183,11 +190,18 @@ public:
     // which are managed in rectangular sections as levels
     std::vector<Level> lvb;     // levels for biomes
     std::vector<Level> lvs;     // levels for structures
+    std::vector<Level> lvl;     // levels for the Lua overlay (same scales as lvb)
     int activelv;
 
     // processed Quads are cached until they are too far out of view
     std::vector<Quad*> cachedbiomes;
     std::vector<Quad*> cachedstruct;
+    std::vector<Quad*> cachedlua;
+
+    // script of the Lua overlay, with a tile() function that is evaluated in
+    // the map worker threads
+    uint64_t luahash;
+    QString luapath;
     uint64_t memlimit;
     QMutex mutex;
     Scheduled *queue;